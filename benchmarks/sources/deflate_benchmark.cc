@@ -0,0 +1,54 @@
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace PSD::llapi;
+
+namespace {
+//
+// Many-small-layer documents spend most of their ZIP time on per-channel
+// setup, so the channels here are small and numerous.
+constexpr unsigned LayerCount   = 2000;
+constexpr unsigned ChannelCount = 4;
+constexpr unsigned RowCount     = 32;
+constexpr unsigned ColumnCount  = 32;
+
+template <typename F>
+double Measure(F function) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+}; // namespace
+
+int main() {
+  std::vector<U8> channel(RowCount * ColumnCount * ByteCount(Depth::Eight));
+  for (auto index = 0u; index < channel.size(); index++) {
+    channel[index] = static_cast<U8>((index / 64) * 7 + index % 5);
+  }
+  for (auto compression : {Compression::Deflate, Compression::DeflateDelta}) {
+    std::vector<std::vector<U8>> compressed(LayerCount * ChannelCount);
+    auto compress = Measure([&]() {
+      for (auto &output : compressed) {
+        output = Compress(channel, RowCount, ColumnCount, Depth::Eight, compression, 6);
+      }
+    });
+    auto decompress = Measure([&]() {
+      for (const auto &input : compressed) {
+        Decompress(input, RowCount, ColumnCount, Depth::Eight, compression);
+      }
+    });
+    std::printf(
+      "%-13s %u channels of %ux%u: compress %8.2f ms, decompress %8.2f ms\n",
+      compression == Compression::Deflate ? "Deflate" : "DeflateDelta",
+      LayerCount * ChannelCount,
+      RowCount,
+      ColumnCount,
+      compress,
+      decompress
+    );
+  }
+  return 0;
+}
@@ -2,11 +2,17 @@
 #pragma once
 
 #include "psd/document/detail/group_processor.h"
+#include "psd/document/detail/layer_decoder.h"
 #include "psd/document/detail/root_converter.h"
+#include "psd/llapi/index_cache.h"
 #include "psd/llapi/structure/header.h"
 #include "psd/llapi/structure/info/layer_info/channel_data.h"
 #include "psd/llapi/structure/resource_info.h"
+#include <algorithm>
 #include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
 
 namespace PSD {
 //
@@ -44,9 +50,9 @@ public:
   auto end() const    { return root_.end();   }
 
   unsigned RowCount()
-  const { return root_.Bottom() - root_.Top(); }
+  const { auto bounds = root_.Bounds(); return bounds.bottom - bounds.top; }
   unsigned ColumnCount()
-  const { return root_.Right() - root_.Left(); }
+  const { auto bounds = root_.Bounds(); return bounds.right - bounds.left; }
 
   void SetCompression(llapi::Compression compr) {
     compression_ = compr;
@@ -57,6 +63,11 @@ public:
   void SetColor(llapi::Color color) {
     color_ = color;
   }
+  // Saving writes a PSB when this is set to it, and on its own when the
+  // document outgrows a PSD. Documents opened from a PSB keep it.
+  void SetVersion(llapi::Version version) {
+    version_ = version;
+  }
 
   llapi::Compression Compression() const {
     return compression_;
@@ -67,6 +78,9 @@ public:
   llapi::Color Color() const {
     return color_;
   }
+  llapi::Version Version() const {
+    return version_;
+  }
 
   void ToggleRendering() {
     rendering_enabled_ = !rendering_enabled_;
@@ -75,14 +89,48 @@ public:
     return rendering_enabled_;
   }
 
+  // Hands layers opened with OpenOptions::lazy back to their compressed
+  // form, largest first, until the pixels they hold decoded fit in
+  // `budget` bytes. Layers that were written to are kept. Returns the
+  // number of bytes freed, pixels still shared with copies of the document
+  // stay with those and are not counted.
+  std::size_t Evict(std::size_t budget = 0) {
+    std::vector<Layer *> layers;
+    CollectEvictable(root_, layers);
+    std::sort(layers.begin(), layers.end(), [](const Layer *left, const Layer *right) {
+      return left->DecodedLength() > right->DecodedLength();
+    });
+    auto total = std::size_t(0);
+    for (const auto *layer : layers) {
+      total += layer->DecodedLength();
+    }
+    auto output = std::size_t(0);
+    for (auto iterator = layers.begin(); iterator != layers.end() && total > budget; iterator++) {
+      total  -= (*iterator)->DecodedLength();
+      output += (*iterator)->Evict();
+    }
+    return output;
+  }
+
 private:
   detail::Root root_;
   llapi::Compression compression_ = llapi::Compression::None;
   unsigned compression_level_ = 6;
   llapi::Color color_ = llapi::Color::Rgb;
+  llapi::Version version_ = llapi::Version::PSD;
 
   bool rendering_enabled_ = false;
 
+  static void CollectEvictable(Group &input, std::vector<Layer *> &output) {
+    for (auto &entry : input) {
+      if (entry->IsLayer() && LayerCast(entry).Evictable()) {
+        output.push_back(&LayerCast(entry));
+      } else if (entry->IsGroup()) {
+        CollectEvictable(GroupCast(entry), output);
+      }
+    }
+  }
+
 }; // class Document
 class DocumentCreator {
 public:
@@ -103,30 +151,181 @@ public:
     document_.SetCompression(input);
     return *this;
   }
+  DocumentCreator &Version(llapi::Version input) {
+    document_.SetVersion(input);
+    return *this;
+  }
   class Document Document() {
     return std::exchange(document_, PSD::Document());
   }
 private:
   class Document document_;
 };
+struct OpenOptions {
+  // Sidecar index file. When set, layer metadata is read from it if it
+  // still matches the document, and it is rebuilt otherwise. The match is
+  // on size, mtime and a hash of 16 samples of 4 KiB, or the whole file up
+  // to 64 KiB: a larger file edited in place without changing its size,
+  // with its mtime restored (rsync -t, coarse timestamps), may be read with
+  // a stale index. Remove the sidecar after such edits.
+  std::filesystem::path index;
+  // Runs the channel decompression, the shared default executor when null.
+  llapi::Executor *executor = nullptr;
+  // Keeps the layer pixels at the depth and color of the file, see
+  // Layer::Pixels, and the document in that color. A layer is converted to
+  // RGBA8 only once its Image() is asked for.
+  bool native = false;
+  // Keeps the channels of every layer compressed until its pixels are
+  // asked for, see Layer::Packed. Opening then only reads the structure,
+  // Document::Evict hands decoded layers back to their compressed form.
+  bool lazy = false;
+  // Keeps the compressed channels of the file, 8-bit RGB only, next to the
+  // layers. Saving writes a channel back from there when it is unmodified
+  // or still decodes to the same bytes, instead of compressing it again.
+  bool reuse_channels = false;
+  // Takes the most common codec among the layer channels of the file as the
+  // document compression, so a plain re-save keeps it.
+  bool keep_compression = false;
+}; // struct OpenOptions
 class OpenFn {
 public:
   Document operator()(const std::filesystem::path &path) const {
-    return CreateDocument(
-      llapi::ConvertColor(
-        llapi::ConvertDepth(
-          llapi::Decompress(llapi::StructureFrom(path)),
-          Depth::Eight
-        ),
-        Color::Rgb
-      )
+    return operator()(path, OpenOptions());
+  }
+  Document operator()(const std::filesystem::path &path, const OpenOptions &options) const {
+    return FromStructure(
+      options.index.empty()
+        ? llapi::StructureFrom(path)
+        : llapi::StructureFrom(path, options.index),
+      options
     );
   }
 private:
-  Document CreateDocument(llapi::Structure input) const {
-    return DocumentCreator(detail::ConvertRoot(input.info.layer_info))
-      .Color(input.header.color)
+  using Sources = std::vector<std::shared_ptr<detail::LayerSource>>;
+
+  // Consumes `input`. Compressed channels are moved into the packed layers
+  // or the sources, names into the layers, and the tree is built in a
+  // single pass without copying any entry.
+  Document FromStructure(llapi::Structure &&input, const OpenOptions &options) const {
+    auto [layer_info, depth] = LayersOf(input);
+    auto compression = CommonCompression(*layer_info);
+    auto decoded = options.lazy
+      ? detail::PackLayers(*layer_info, depth, input.header, options.native)
+      : detail::DecodeLayers(
+          *layer_info,
+          depth,
+          input.header,
+          options.executor ? *options.executor : llapi::DefaultExecutor(),
+          options.native
+        );
+    auto sources = options.reuse_channels
+      ? CaptureSources(input, options.lazy ? &decoded : nullptr)
+      : Sources();
+    auto output = DocumentCreator(detail::ConvertRoot(std::move(*layer_info), decoded))
+      .Color(options.native ? input.header.color : Color::Rgb)
+      .Version(input.header.version)
       .Document();
+    AttachSources(output, sources);
+    if (options.keep_compression && compression) {
+      output.SetCompression(*compression);
+    }
+    return output;
+  }
+
+  // 16 and 32-bit layers live in their own block of the additional layer
+  // information. The channels stay compressed, DecodeLayers turns them into
+  // RGBA8 layer images directly.
+  std::pair<llapi::LayerInfo *, Depth> LayersOf(llapi::Structure &input) const {
+    auto &extra_info = input.info.extra_info;
+    if (extra_info.Exists<llapi::Layer16>()) {
+      return {&extra_info.At<llapi::Layer16>().data, Depth::Sixteen};
+    }
+    if (extra_info.Exists<llapi::Layer32>()) {
+      return {&extra_info.At<llapi::Layer32>().data, Depth::ThirtyTwo};
+    }
+    return {&input.info.layer_info, input.header.depth};
+  }
+  std::optional<llapi::Compression> CommonCompression(const llapi::LayerInfo &input) const {
+    std::map<llapi::Compression, unsigned> counts;
+    for (const auto &record : input.record) {
+      if (!detail::IsLayer(record)) {
+        continue;
+      }
+      for (const auto &[id, channel] : record.channel_data.data) {
+        counts[channel.compression]++;
+      }
+    }
+    if (counts.empty()) {
+      return std::nullopt;
+    }
+    return std::max_element(counts.begin(), counts.end(), [](const auto &left, const auto &right) {
+      return left.second < right.second;
+    })->first;
+  }
+  // Keeps the compressed channels of every layer record, moved out of the
+  // records and held with KeepBytes, for a later save to reuse. Only files
+  // stored the way Save writes them, 8-bit RGB, are worth keeping. Packed
+  // layers already hold them, theirs are shared.
+  Sources CaptureSources(llapi::Structure &input, const detail::DecodedLayers *packed = nullptr) const {
+    Sources output;
+    if (input.header.depth != Depth::Eight || input.header.color != Color::Rgb) {
+      return output;
+    }
+    for (auto &record : input.info.layer_info.record) {
+      if (!detail::IsLayer(record)) {
+        continue;
+      }
+      auto source = std::make_shared<detail::LayerSource>();
+      const auto &coordinates = record.layer_data.coordinates;
+      source->version      = input.header.version;
+      source->row_count    = unsigned(coordinates.bottom - coordinates.top);
+      source->column_count = unsigned(coordinates.right  - coordinates.left);
+      std::shared_ptr<const detail::PackedLayer> owner;
+      if (packed) {
+        if (auto found = packed->find(&record); found != packed->end()) {
+          owner = found->second.packed;
+        }
+      }
+      for (auto &[id, channel] : record.channel_data.data) {
+        if (id < -1 || id > 2) {
+          continue;
+        }
+        auto &copy = source->channels[id];
+        copy.compression = channel.compression;
+        if (owner) {
+          const auto &data = owner->channels.at(id).data;
+          copy.data = llapi::Bytes(owner, data.data(), data.size());
+        } else {
+          copy.data = detail::KeepBytes(std::move(channel.data));
+        }
+      }
+      output.push_back(std::move(source));
+    }
+    return output;
+  }
+  // Layers come out of the records depth first in record order, sources are
+  // matched the same way.
+  void AttachSources(Document &output, const Sources &sources) const {
+    std::vector<Layer *> layers;
+    CollectLayers(output.root_, layers);
+    if (sources.empty() || layers.size() != sources.size()) {
+      return;
+    }
+    for (auto index = 0u;
+              index < layers.size();
+              index++) {
+      layers[index]->source_   = sources[index];
+      layers[index]->modified_ = false;
+    }
+  }
+  void CollectLayers(Group &input, std::vector<Layer *> &output) const {
+    for (auto &entry : input) {
+      if (entry->IsLayer()) {
+        output.push_back(&LayerCast(entry));
+      } else if (entry->IsGroup()) {
+        CollectLayers(GroupCast(entry), output);
+      }
+    }
   }
 }; // class OpenFn
 inline constexpr auto Open = OpenFn();
@@ -142,11 +341,56 @@ public:
 }; // class ExportFn
 inline constexpr ExportFn Export = ExportFn();
 
+struct SaveStatistics {
+  // Codec picked per channel, summed up. Tells what an adaptive save chose.
+  llapi::CompressionStatistics compression;
+  // Size of the saved file.
+  llapi::U64 length = 0;
+}; // struct SaveStatistics
+struct SaveOptions {
+  // Runs the channel compression, the shared default executor when null.
+  llapi::Executor *executor = nullptr;
+  // Picks the codec of each channel within these limits when set, in place
+  // of the document compression.
+  std::optional<llapi::AdaptiveBudget> adaptive;
+  // Filled in after saving when set.
+  SaveStatistics *statistics = nullptr;
+}; // struct SaveOptions
 class SaveFn {
   auto CreateHeader(
     const Document &input
   ) const {
-    return llapi::Header(input.RowCount(), input.ColumnCount());
+    llapi::Header output(input.RowCount(), input.ColumnCount());
+    output.version = VersionFor(input);
+    return output;
+  }
+  // Lengths in the layer section of a PSD are 32-bit. A PSB is written
+  // when the document asks for one, is too large for a PSD, or has layer
+  // channels that could outgrow those lengths even at their worst
+  // compression, so the save never fails halfway through the file.
+  llapi::Version VersionFor(const Document &input) const {
+    if (input.version_ == llapi::Version::PSB ||
+        llapi::Header::VersionFor(input.RowCount(), input.ColumnCount()) == llapi::Version::PSB) {
+      return llapi::Version::PSB;
+    }
+    auto length = llapi::U64(0);
+    CollectLength(input.root_, length);
+    return length > std::numeric_limits<llapi::U32>::max() ? llapi::Version::PSB : llapi::Version::PSD;
+  }
+  // Upper bound on the compressed channels of every layer: RLE adds a
+  // count byte per 128 and a length per row, deflate less than that.
+  void CollectLength(const Group &input, llapi::U64 &output) const {
+    for (const auto &entry : input) {
+      if (entry->IsGroup()) {
+        CollectLength(GroupCast(entry), output);
+        continue;
+      }
+      auto coordinates = entry->Bounds();
+      auto rows    = llapi::U64(coordinates.bottom - coordinates.top);
+      auto columns = llapi::U64(coordinates.right  - coordinates.left);
+      auto channel = rows * columns;
+      output += 4 * (channel + channel / 64 + rows * 4 + 64) + 1024;
+    }
   }
   auto CreateResourceInfo(
     const Document &input
@@ -154,9 +398,16 @@ class SaveFn {
     return llapi::ResourceInfo();
   }
   auto CreateInfo(
-    const Document &input
+    const Document      &input,
+    const llapi::Header &header,
+    const SaveOptions   &options
   ) const {
-    return llapi::Info(detail::ConvertRoot(input.root_));
+    return llapi::Info(detail::ConvertRoot(input.root_, detail::ChannelReuse{
+      input.color_ == Color::Rgb,
+      header.version,
+      input.compression_,
+      options.adaptive.has_value()
+    }));
   }
   auto CreateImage(
     const Document &input
@@ -165,42 +416,63 @@ class SaveFn {
       return ProcessImage(detail::ProcessGroup(input.root_));
     } else {
       return llapi::Image(std::vector<llapi::U8>(
-        input.RowCount() * input.ColumnCount() * 3, 0x00
+        std::size_t(input.RowCount()) * input.ColumnCount() * 3, 0x00
       ));
     }
   }
 public:
   void operator()(const Document &input, const std::filesystem::path &path) const {
-    llapi::DumpStructure(
-      llapi::Compress(
-        llapi::ConvertColor(
-          llapi::Structure(
-            CreateHeader       (input),
-            CreateResourceInfo (input),
-            CreateInfo         (input),
-            CreateImage        (input)
-          ),
-          input.color_
+    operator()(input, path, SaveOptions());
+  }
+  void operator()(const Document &input, const std::filesystem::path &path, const SaveOptions &options) const {
+    CheckDepth(input.root_);
+    auto header    = CreateHeader(input);
+    auto structure = llapi::Compress(
+      llapi::ConvertColor(
+        llapi::Structure(
+          header,
+          CreateResourceInfo (input),
+          CreateInfo         (input, header, options),
+          CreateImage        (input)
         ),
-        input.compression_,
-        input.compression_level_
+        input.color_
       ),
-      path
+      input.compression_,
+      input.compression_level_,
+      options.executor ? *options.executor : llapi::DefaultExecutor(),
+      options.adaptive
     );
+    llapi::DumpStructure(structure, path);
+    if (options.statistics) {
+      options.statistics->compression = llapi::StatisticsOf(structure);
+      options.statistics->length      = std::filesystem::file_size(path);
+    }
   }
 private:
+  // Documents are saved at 8 bits. Layers still holding deeper pixels from
+  // OpenOptions::native are refused rather than narrowed behind the
+  // caller's back; editing them through Layer::Edit converts them first.
+  void CheckDepth(const Group &input) const {
+    for (const auto &entry : input) {
+      if (entry->IsGroup()) {
+        CheckDepth(GroupCast(entry));
+      } else if (entry->IsLayer() && LayerCast(entry).Depth() != Depth::Eight) {
+        throw Error("PSD::Error: UnsupportedDepth");
+      }
+    }
+  }
   llapi::Image ProcessImage(const ::Image::Buffer<> &input) const {
-    llapi::Image output = llapi::Image(std::vector<llapi::U8>(input.Length() * input.ChannelCount()));
+    std::vector<llapi::U8> output(input.Length() * input.ChannelCount());
     for (auto channel = 0u;
               channel < input.ChannelCount()-1;
               channel++) {
       for (auto index = 0u;
                 index < input.Length();
                 index++) {
-        output.data[input.Length() * channel + index] = input[index][channel];
+        output[input.Length() * channel + index] = input[index][channel];
       }
     }
-    return output;
+    return llapi::Image(std::move(output));
   }
 }; // class SaveFn
 
@@ -227,15 +499,32 @@ public:
 }; // class DecodeToFn
 inline constexpr auto DecodeTo = DecodeToFn();
 } // namespace detail
+struct DecodeOptions {
+  // Keeps every `factor`-th row of the composite and averages each
+  // `factor` columns of it into one pixel. Skipped rows are never decoded.
+  unsigned factor = 1;
+  // When set, the smallest factor that fits the composite into this many
+  // rows and columns is used instead.
+  unsigned max_row_count    = 0;
+  unsigned max_column_count = 0;
+}; // struct DecodeOptions
 class DecodeFn {
 public:
   ::Image::Buffer<> operator()(const std::filesystem::path &path) const {
-    llapi::Stream stream(path);
+    return operator()(path, DecodeOptions());
+  }
+  ::Image::Buffer<> operator()(const std::filesystem::path &path, const DecodeOptions &options) const {
+    llapi::Stream stream(path, llapi::Advice::Random);
     auto header = stream.Read<llapi::Header>();
     stream     += stream.Read<llapi::U32>(); // skip color info
     stream     += stream.Read<llapi::U32>(); // skip resource info
-    stream     += stream.Read<llapi::U32>(); // skip info
+    stream     += stream.ReadLength();       // skip info
+    stream.Advise(llapi::Advice::Sequential);
     auto image  = stream.Read<llapi::Image>();
+    auto factor = FactorFor(header, options);
+    if (factor != 1) {
+      return Preview(header, image, factor);
+    }
     image.Decompress(header);
     ::Image::Buffer<> output(
       header.row_count,
@@ -251,6 +540,49 @@ public:
     );
     return output;
   }
+private:
+  unsigned FactorFor(const llapi::Header &header, const DecodeOptions &options) const {
+    auto output = std::max(options.factor, 1u);
+    if (options.max_row_count) {
+      output = std::max(output, (header.row_count + options.max_row_count - 1) / options.max_row_count);
+    }
+    if (options.max_column_count) {
+      output = std::max(output, (header.column_count + options.max_column_count - 1) / options.max_column_count);
+    }
+    return output;
+  }
+  // The composite stores its channels one after the other, so a single
+  // decoder walks all of them and skips the rows in between.
+  ::Image::Buffer<> Preview(const llapi::Header &header, const llapi::Image &image, unsigned factor) const {
+    ::Image::Buffer<> output(
+      (header.row_count    + factor - 1) / factor,
+      (header.column_count + factor - 1) / factor,
+      header.channel_count
+    );
+    if (!output.Length()) {
+      return output;
+    }
+    llapi::RowDecoder decoder(
+      image.data,
+      image.compression,
+      header.row_count * header.channel_count,
+      header.column_count,
+      header.depth,
+      header.version
+    );
+    for (auto channel = 0u;
+              channel < output.ChannelCount();
+              channel++) {
+      llapi::DecodeChannelTo(
+        decoder,
+        header.row_count,
+        factor,
+        &*output.begin() + channel,
+        output.ChannelCount()
+      );
+    }
+    return output;
+  }
 }; // class DecodeFn
 
 inline constexpr auto Decode = DecodeFn();
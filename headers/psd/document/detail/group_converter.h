@@ -17,17 +17,17 @@ class GroupConverter;
 template <>
 class GroupConverter<Group> {
 public:
-  std::vector<llapi::LayerRecord> operator()(const Group &input) {
+  std::vector<llapi::LayerRecord> operator()(const Group &input, const ChannelReuse &reuse = ChannelReuse()) {
     std::vector<llapi::LayerRecord> output;
     output.push_back(CreateStart());
 
     for (const auto &entry : input) {
       if (entry->IsLayer()) {
-        output.push_back(LayerConverter<Layer>()(LayerCast(entry)));
+        output.push_back(LayerConverter<Layer>()(LayerCast(entry), reuse));
         continue;
       }
       if (entry->IsGroup()) {
-        auto input = GroupConverter<Group>()(GroupCast(entry));
+        auto input = GroupConverter<Group>()(GroupCast(entry), reuse);
         output.insert(output.end(), input.begin(), input.end());
         continue;
       }
@@ -101,60 +101,4 @@ inline bool IsGroupEnd(const llapi::LayerRecord &input) {
   return type == llapi::DividerType::OpenFolder ||
          type == llapi::DividerType::ClosedFolder;
 }
-template <typename I>
-I FindGroupEnd(I input, I end) {
-  for (; input != end; input++) {
-    if (IsGroupEnd(*input)) return ++input;
-  }
-  return end;
-}
-inline unsigned GroupRecordCount(const Group &input) {
-  unsigned output = 2;
-  for (const auto &entry : input) {
-    if (entry->IsLayer()) {
-      output++;
-      continue;
-    }
-    if (entry->IsGroup()) {
-      output += GroupRecordCount(GroupCast(entry));
-      continue;
-    }
-    assert(false);
-  }
-  return output;
-}
-template <>
-class GroupConverter<llapi::LayerRecord> {
-public:
-  template <typename I>
-  Group operator()(I input, I end) {
-    if (!IsGroupStart(*input) && !IsGroupEnd(*input)) {
-      throw Error("Cannot be converter");
-    }
-    input++;
-    Group output("");
-    while (input != end) {
-      if (IsLayer(*input)) {
-        output.Push(LayerConverter<llapi::LayerRecord>()(*input++));
-        continue;
-      }
-      if (IsGroupStart(*input)) {
-        auto group = GroupConverter<llapi::LayerRecord>()(
-          input,
-          FindGroupEnd(input, end)
-        );
-        input += GroupRecordCount(group);
-        output.Push(std::move(group));
-        continue;
-      }
-      if (IsGroupEnd(*input)) {
-        output.SetName(input->layer_data.name);
-        input++;
-        break;
-      }
-      assert(false);
-    }
-    return output;
-  }
-};
 }; // PSD::detail
@@ -13,9 +13,10 @@ namespace PSD::detail {
 class GroupProcessor {
 public:
   ::Image::Buffer<> operator()(const Group &input) const {
+    auto bounds = input.Bounds();
     ::Image::Buffer<> output(
-      input.Bottom() - input.Top(),
-      input.Right()  - input.Left()
+      bounds.bottom - bounds.top,
+      bounds.right  - bounds.left
     );
     for (auto entry : input) {
       if (entry->IsLayer()) {
@@ -32,20 +33,22 @@ public:
   }
 private:
   void ProcessLayer(const Group &group, ::Image::Buffer<> &output, const Layer &input) const {
+    auto bounds = group.Bounds();
     Image::Blend(
       output,
       LayerProcessor()(input),
-      input.Left() - group.Left(),
-      input.Top()  - group.Top(),
+      input.Left() - bounds.left,
+      input.Top()  - bounds.top,
       Image::Blending::Normal
     );
   }
   void ProcessGroup(const Group &group, ::Image::Buffer<> &output, const Group &input) const {
+    auto bounds = group.Bounds();
     Image::Blend(
       output,
       GroupProcessor()(input),
-      input.Left() - group.Left(),
-      input.Top()  - group.Top(),
+      input.Left() - bounds.left,
+      input.Top()  - bounds.top,
       Image::Blending::Normal
     );
   }
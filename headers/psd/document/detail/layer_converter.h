@@ -5,36 +5,59 @@
 #include "psd/llapi/structure/info/layer_info/channel_data.h"
 #include <psd/llapi/structure/info/layer_info.h>
 #include <psd/document/layer.h>
+#include <psd/document/detail/layer_decoder.h>
 
 namespace PSD::detail {
 //
 
+// What a save writes, a channel kept from the opened file is only reused
+// when it is stored the same way.
+struct ChannelReuse {
+  bool               enabled     = false;
+  llapi::Version     version     = llapi::Version::PSD;
+  llapi::Compression compression = llapi::Compression::None;
+  // Channels may be stored with any codec, as an adaptive save picks one.
+  bool               adaptive    = false;
+}; // struct ChannelReuse
+
 template <typename T>
 class LayerConverter;
 
 template <>
 class LayerConverter<Layer> {
 public:
-  llapi::LayerRecord operator()(const Layer &input) {
+  llapi::LayerRecord operator()(const Layer &input, const ChannelReuse &reuse = ChannelReuse()) {
     llapi::LayerRecord output;
     CreateLayerData(input, output.layer_data);
-    CreateChannelData(input, output.channel_data);
+    CreateChannelData(input, reuse, output.channel_data);
     return output;
   }
 private:
+  // Layer images are RGBA8. Taken as a constant so that a layer still packed
+  // is not decoded just to count its channels.
+  static constexpr unsigned ChannelCount = 4;
+
   void CreateLayerData(const Layer &input, llapi::LayerData &output) {
     output.coordinates   = input.Coordinates();
-    output.channel_count = input.Image().ChannelCount();
+    output.channel_count = ChannelCount;
     output.blending      = llapi::Blending::Normal;
     output.opacity       = 0xff;
     output.clipping      = false;
     output.name          = input.Name();
   }
-  void CreateChannelData(const Layer &input, llapi::ChannelData &output) {
+  // Unmodified layers hand their original channels over untouched, modified
+  // ones only keep those whose source still decodes to the same bytes.
+  void CreateChannelData(const Layer &input, const ChannelReuse &reuse, llapi::ChannelData &output) {
     for (auto channel = 0u;
-              channel < input.Image().ChannelCount();
+              channel < ChannelCount;
               channel++)
     {
+      auto id     = llapi::I16((channel == 3) ? -1 : channel);
+      auto source = SourceFor(input, reuse, id);
+      if (source && !input.modified_) {
+        output.data[id] = Borrow(input, *source);
+        continue;
+      }
       std::vector<llapi::U8> channel_data(input.Image().Length());
       for (auto index = 0u;
                 index < input.Image().Length();
@@ -42,16 +65,72 @@ private:
       {
         channel_data[index] = input.Image()[index][channel];
       }
-      output.data[(channel == 3) ? -1 : channel] = llapi::Channel(std::move(channel_data));
+      if (source && SourceMatches(input, *source, channel_data)) {
+        output.data[id] = Borrow(input, *source);
+      } else {
+        output.data[id] = llapi::Channel(std::move(channel_data));
+      }
+    }
+  }
+  const llapi::Channel *SourceFor(const Layer &input, const ChannelReuse &reuse, llapi::I16 id) {
+    if (!reuse.enabled || !input.source_ || input.source_->version != reuse.version) {
+      return nullptr;
+    }
+    auto found = input.source_->channels.find(id);
+    if (found == input.source_->channels.end()) {
+      return nullptr;
     }
+    if (found->second.compression != reuse.compression && !reuse.adaptive) {
+      return nullptr;
+    }
+    return &found->second;
+  }
+  // Only reached for layers that were written to, so the source is decoded
+  // here rather than on open.
+  bool SourceMatches(const Layer &input, const llapi::Channel &source, const std::vector<llapi::U8> &data) {
+    auto row_count    = input.source_->row_count;
+    auto column_count = input.source_->column_count;
+    if (input.Image().RowCount()    != row_count ||
+        input.Image().ColumnCount() != column_count) {
+      return false;
+    }
+    std::vector<llapi::U8> decoded(data.size());
+    llapi::DecodeChannelTo(
+      source.data,
+      source.compression,
+      row_count,
+      column_count,
+      llapi::Depth::Eight,
+      input.source_->version,
+      decoded.data(),
+      1
+    );
+    return decoded == data;
+  }
+  llapi::Channel Borrow(const Layer &input, const llapi::Channel &source) {
+    llapi::Channel output;
+    output.compression = source.compression;
+    output.data        = llapi::Bytes(input.source_, source.data.data(), source.data.size());
+    return output;
   }
 }; // class LayerConverter<Layer>
 template <>
 class LayerConverter<llapi::LayerRecord> {
 public:
-  Layer operator()(const llapi::LayerRecord &input) {
-    Layer output(input.layer_data.name);
-    output.SetImage(ConvertData(input));
+  // Takes the image or the native pixels out of `decoded` when given, the
+  // channels of `input` are then still compressed. The name is moved out
+  // of `input`.
+  Layer operator()(llapi::LayerRecord &&input, DecodedLayers *decoded = nullptr) {
+    Layer output(std::move(input.layer_data.name));
+    if (!decoded) {
+      output.SetImage(ConvertData(input));
+    } else if (auto &layer = decoded->at(&input); layer.packed) {
+      output.SetPacked(std::move(layer.packed));
+    } else if (layer.pixels) {
+      output.SetPixels(std::move(layer.pixels));
+    } else {
+      output.SetImage(std::move(layer.image));
+    }
     output.SetOffset(
       input.layer_data.coordinates.left,
       input.layer_data.coordinates.top
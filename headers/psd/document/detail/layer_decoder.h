@@ -0,0 +1,232 @@
+#pragma once
+
+#include <psd/document/detail/layer_pixels.h>
+#include <psd/error.h>
+#include <psd/llapi/executor.h>
+#include <psd/llapi/structure/header.h>
+#include <psd/llapi/structure/info/layer_info.h>
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+#include <image/image.h>
+#include <map>
+#include <memory>
+
+namespace PSD::detail {
+//
+using Channels = std::map<llapi::I16, llapi::Channel>;
+
+// Channel bytes held on to past the open. A POSIX mapping stays readable
+// after Save renames a new file over the one it maps, so bytes borrowed
+// from it are kept as they are. Windows may refuse to replace a file that
+// is still mapped, they are copied there so the mapping can be closed.
+inline llapi::Bytes KeepBytes(llapi::Bytes &&input) {
+#ifdef _WIN32
+  return std::move(input).Release();
+#else
+  return std::move(input);
+#endif
+}
+
+// Compressed channels of a layer together with everything needed to decode
+// them, what a layer opened with OpenOptions::lazy holds until its pixels
+// are asked for. The bytes are kept with KeepBytes.
+struct PackedLayer {
+  llapi::Depth   depth        = llapi::Depth::Eight;
+  llapi::Color   color        = llapi::Color::Rgb;
+  llapi::Version version      = llapi::Version::PSD;
+  unsigned       row_count    = 0;
+  unsigned       column_count = 0;
+  bool           native       = false;
+  Channels       channels;
+}; // struct PackedLayer
+
+// Either the RGBA8 image of a layer or, when opened natively, its pixels.
+// Layers opened lazily only get their packed channels.
+struct DecodedLayer {
+  ::Image::Buffer<>                  image;
+  std::shared_ptr<const LayerPixels> pixels;
+  std::shared_ptr<const PackedLayer> packed;
+}; // struct DecodedLayer
+using DecodedLayers = std::map<const llapi::LayerRecord *, DecodedLayer>;
+
+// Decodes the still compressed `channels` into the RGBA8 image of a layer,
+// each channel written straight into its component. Grayscale is spread
+// over the three color components, a missing alpha is opaque.
+inline void DecodeLayerTo(
+  const Channels      &channels,
+  llapi::Depth         depth,
+  llapi::Color         color,
+  llapi::Version       version,
+  ::Image::Buffer<>   &output
+) {
+  if (!output.Length()) {
+    return;
+  }
+  auto data   = &*output.begin();
+  auto stride = std::size_t(output.ChannelCount());
+  auto decode = [&](const llapi::Channel &channel, unsigned component) {
+    llapi::DecodeChannelTo(
+      channel.data,
+      channel.compression,
+      output.RowCount(),
+      output.ColumnCount(),
+      depth,
+      version,
+      data + component,
+      stride
+    );
+  };
+  for (auto id = 0; id < (color == llapi::Color::Grayscale ? 1 : 3); id++) {
+    auto found = channels.find(llapi::I16(id));
+    if (found != channels.end()) {
+      decode(found->second, id);
+    }
+  }
+  if (color == llapi::Color::Grayscale) {
+    for (auto index = 0u; index < output.Length(); index++) {
+      data[index * stride + 1] = data[index * stride];
+      data[index * stride + 2] = data[index * stride];
+    }
+  }
+  if (auto found = channels.find(-1); found != channels.end()) {
+    decode(found->second, 3);
+  } else {
+    for (auto index = 0u; index < output.Length(); index++) {
+      data[index * stride + 3] = 0xff;
+    }
+  }
+}
+
+inline void DecodeLayerTo(
+  const llapi::LayerRecord &input,
+  llapi::Depth              depth,
+  const llapi::Header      &header,
+  ::Image::Buffer<>        &output
+) {
+  DecodeLayerTo(input.channel_data.data, depth, header.color, header.version, output);
+}
+
+// Decodes the color and alpha channels into planes, as they are. Masks are
+// left out, their bounds differ from those of the layer.
+inline LayerPixels DecodePixels(
+  const Channels &channels,
+  unsigned        row_count,
+  unsigned        column_count,
+  llapi::Depth    depth,
+  llapi::Color    color,
+  llapi::Version  version
+) {
+  LayerPixels output;
+  output.depth        = depth;
+  output.color        = color;
+  output.row_count    = row_count;
+  output.column_count = column_count;
+  for (const auto &[id, channel] : channels) {
+    if (id < -1) {
+      continue;
+    }
+    llapi::RowDecoder decoder(channel, row_count, column_count, depth, version);
+    auto &plane = output.channels[id];
+    plane.resize(decoder.RowLength() * output.row_count);
+    for (auto offset = std::size_t(0); !decoder.Done(); offset += decoder.RowLength()) {
+      auto row = decoder.Next();
+      std::copy(row.begin(), row.end(), plane.begin() + offset);
+    }
+  }
+  return output;
+}
+inline LayerPixels DecodePixels(
+  const llapi::LayerRecord &input,
+  llapi::Depth              depth,
+  const llapi::Header      &header
+) {
+  const auto &coordinates = input.layer_data.coordinates;
+  return DecodePixels(
+    input.channel_data.data,
+    unsigned(coordinates.bottom - coordinates.top),
+    unsigned(coordinates.right  - coordinates.left),
+    depth,
+    header.color,
+    header.version
+  );
+}
+inline LayerPixels DecodePixels(const PackedLayer &input) {
+  return DecodePixels(input.channels, input.row_count, input.column_count, input.depth, input.color, input.version);
+}
+inline ::Image::Buffer<> DecodeImage(const PackedLayer &input) {
+  if (input.color != llapi::Color::Rgb &&
+      input.color != llapi::Color::Grayscale) throw Error("PSD::Error: UnsupportedColor");
+  ::Image::Buffer<> output(input.row_count, input.column_count);
+  DecodeLayerTo(input.channels, input.depth, input.color, input.version, output);
+  return output;
+}
+
+// Layers only ever become RGBA8 from these colors, files in any other are
+// refused as they are opened rather than once a layer is used.
+inline void CheckColor(llapi::Color color) {
+  if (color != llapi::Color::Rgb &&
+      color != llapi::Color::Grayscale) throw Error("PSD::Error: UnsupportedColor");
+}
+
+// One job per record, largest first. The results are keyed by record so the
+// converters can pick them up while walking the layer tree. With `native`
+// the pixels keep the depth and color of the file.
+inline DecodedLayers DecodeLayers(
+  const llapi::LayerInfo &input,
+  llapi::Depth            depth,
+  const llapi::Header    &header,
+  llapi::Executor        &executor = llapi::DefaultExecutor(),
+  bool                    native   = false
+) {
+  CheckColor(header.color);
+  DecodedLayers output;
+  std::vector<std::pair<llapi::U64, llapi::Job>> pending;
+  for (const auto &record : input.record) {
+    const auto &coordinates = record.layer_data.coordinates;
+    auto row_count    = unsigned(coordinates.bottom - coordinates.top);
+    auto column_count = unsigned(coordinates.right  - coordinates.left);
+    auto &layer = output[&record];
+    pending.emplace_back(llapi::U64(row_count) * column_count, [&record, &layer, &header, depth, native, row_count, column_count]() {
+      if (native) {
+        layer.pixels = std::make_shared<const LayerPixels>(DecodePixels(record, depth, header));
+      } else {
+        layer.image = ::Image::Buffer<>(row_count, column_count);
+        DecodeLayerTo(record, depth, header, layer.image);
+      }
+    });
+  }
+  llapi::RunLargestFirst(pending, executor);
+  return output;
+}
+
+// Moves the compressed color and alpha channels out of every record,
+// nothing is decoded.
+inline DecodedLayers PackLayers(
+  llapi::LayerInfo       &input,
+  llapi::Depth            depth,
+  const llapi::Header    &header,
+  bool                    native = false
+) {
+  CheckColor(header.color);
+  DecodedLayers output;
+  for (auto &record : input.record) {
+    const auto &coordinates = record.layer_data.coordinates;
+    auto packed = std::make_shared<PackedLayer>();
+    packed->depth        = depth;
+    packed->color        = header.color;
+    packed->version      = header.version;
+    packed->row_count    = unsigned(coordinates.bottom - coordinates.top);
+    packed->column_count = unsigned(coordinates.right  - coordinates.left);
+    packed->native       = native;
+    for (auto &[id, channel] : record.channel_data.data) {
+      if (id < -1) {
+        continue;
+      }
+      auto &copy = packed->channels[id];
+      copy.compression = channel.compression;
+      copy.data        = KeepBytes(std::move(channel.data));
+    }
+    output[&record].packed = std::move(packed);
+  }
+  return output;
+}
+}; // namespace PSD::detail
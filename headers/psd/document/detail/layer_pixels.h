@@ -0,0 +1,92 @@
+#pragma once
+
+#include <psd/error.h>
+#include <psd/llapi/structure/header.h>
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+#include <image/image.h>
+#include <map>
+#include <vector>
+
+namespace PSD::detail {
+//
+// Decoded channels of a layer at the depth and color of the file it came
+// from, one plane per channel id with samples in native byte order.
+struct LayerPixels {
+  llapi::Depth                                 depth        = llapi::Depth::Eight;
+  llapi::Color                                 color        = llapi::Color::Rgb;
+  unsigned                                     row_count    = 0;
+  unsigned                                     column_count = 0;
+  std::map<llapi::I16, std::vector<llapi::U8>> channels;
+
+  std::size_t Length() const {
+    return std::size_t(row_count) * column_count;
+  }
+  // Samples of channel `id` as U8, U16 or F32 to match `depth`, null when
+  // the layer has no such channel.
+  template <typename T>
+  const T *Channel(llapi::I16 id) const {
+    auto found = channels.find(id);
+    if (found == channels.end()) {
+      return nullptr;
+    }
+    return reinterpret_cast<const T *>(found->second.data());
+  }
+}; // struct LayerPixels
+
+// Same RGBA8 layout a layer opened without OpenOptions::native gets.
+// Grayscale is spread over the color components, a missing alpha is
+// opaque.
+inline ::Image::Buffer<> ToImage(const LayerPixels &input) {
+  if (input.color != llapi::Color::Rgb &&
+      input.color != llapi::Color::Grayscale) throw Error("PSD::Error: UnsupportedColor");
+  ::Image::Buffer<> output(input.row_count, input.column_count);
+  if (!output.Length()) {
+    return output;
+  }
+  auto data   = &*output.begin();
+  auto stride = std::size_t(output.ChannelCount());
+  std::vector<llapi::U8> plane(input.depth == llapi::Depth::Eight ? 0 : input.Length());
+  auto emit = [&](llapi::I16 id, unsigned component) {
+    auto found = input.channels.find(id);
+    if (found == input.channels.end()) {
+      return false;
+    }
+    const auto *samples = found->second.data();
+    switch (input.depth) {
+      case llapi::Depth::Eight:
+        break;
+      case llapi::Depth::Sixteen:
+        llapi::ConvertSamples(reinterpret_cast<const llapi::U16 *>(samples), plane.data(), input.Length());
+        samples = plane.data();
+        break;
+      case llapi::Depth::ThirtyTwo:
+        llapi::ConvertSamples(reinterpret_cast<const llapi::F32 *>(samples), plane.data(), input.Length());
+        samples = plane.data();
+        break;
+      default:
+        throw Error("PSD::Error: UnsupportedDepth");
+    }
+    for (auto index = std::size_t(0); index < input.Length(); index++) {
+      data[index * stride + component] = samples[index];
+    }
+    return true;
+  };
+  if (input.color == llapi::Color::Grayscale) {
+    emit(0, 0);
+    for (auto index = std::size_t(0); index < input.Length(); index++) {
+      data[index * stride + 1] = data[index * stride];
+      data[index * stride + 2] = data[index * stride];
+    }
+  } else {
+    for (auto id = 0; id < 3; id++) {
+      emit(llapi::I16(id), id);
+    }
+  }
+  if (!emit(-1, 3)) {
+    for (auto index = std::size_t(0); index < input.Length(); index++) {
+      data[index * stride + 3] = 0xff;
+    }
+  }
+  return output;
+}
+}; // namespace PSD::detail
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+#include <map>
+
+namespace PSD::detail {
+//
+// Compressed channels a layer was opened with. Save writes a channel back
+// from here instead of compressing it again while the layer is unmodified,
+// or when the channel still decodes to the same bytes.
+struct LayerSource {
+  llapi::Version                       version      = llapi::Version::PSD;
+  unsigned                             row_count    = 0;
+  unsigned                             column_count = 0;
+  std::map<llapi::I16, llapi::Channel> channels;
+}; // struct LayerSource
+}; // namespace PSD::detail
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <psd/document/detail/layer_decoder.h>
+#include <psd/document/detail/layer_pixels.h>
+#include <image/image.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace PSD::detail {
+//
+// Pixels of a layer in whichever forms were asked for so far, shared by
+// every copy of the layer and never written to once filled in. A layer
+// opened lazily starts out with only the packed channels, one opened
+// natively with only its pixels; the RGBA8 image is derived from whichever
+// is there on first use, once for all copies. Every member locks, so copies
+// of a layer can be read from several threads at once.
+class LayerState {
+public:
+  LayerState() = default;
+  explicit LayerState(::Image::Buffer<> image)
+    : image_(std::move(image)) {}
+  explicit LayerState(std::shared_ptr<const LayerPixels> pixels)
+    : pixels_(std::move(pixels)) {}
+  explicit LayerState(std::shared_ptr<const PackedLayer> packed)
+    : packed_(std::move(packed)) {}
+
+  // The reference stays valid for as long as the state does.
+  const ::Image::Buffer<> &Image() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Materialize();
+  }
+  // Moves the image out, only for a state no other layer shares.
+  ::Image::Buffer<> TakeImage() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Materialize();
+    return std::exchange(image_, std::nullopt).value();
+  }
+  const LayerPixels *Pixels() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Unpack();
+    return pixels_.get();
+  }
+  const std::shared_ptr<const PackedLayer> &Packed() const {
+    return packed_;
+  }
+  bool Decoded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return image_ || pixels_;
+  }
+
+  llapi::Depth Depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pixels_) {
+      return pixels_->depth;
+    }
+    return packed_ && packed_->native ? packed_->depth : llapi::Depth::Eight;
+  }
+  llapi::Color Color() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pixels_) {
+      return pixels_->color;
+    }
+    return packed_ && packed_->native ? packed_->color : llapi::Color::Rgb;
+  }
+  unsigned RowCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (image_) {
+      return image_->RowCount();
+    }
+    if (pixels_) {
+      return pixels_->row_count;
+    }
+    return packed_ ? packed_->row_count : 0;
+  }
+  unsigned ColumnCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (image_) {
+      return image_->ColumnCount();
+    }
+    if (pixels_) {
+      return pixels_->column_count;
+    }
+    return packed_ ? packed_->column_count : 0;
+  }
+
+  // Bytes taken by the decoded image and native pixels.
+  std::size_t DecodedLength() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Length();
+  }
+private:
+  mutable std::mutex                                 mutex_;
+  mutable std::optional<::Image::Buffer<>>           image_;
+  mutable std::shared_ptr<const LayerPixels>         pixels_;
+  std::shared_ptr<const PackedLayer>                 packed_;
+
+  const ::Image::Buffer<> &Materialize() const {
+    if (!image_) {
+      Unpack();
+      if (pixels_) {
+        image_ = ToImage(*pixels_);
+      } else if (packed_) {
+        image_ = DecodeImage(*packed_);
+      } else {
+        image_.emplace();
+      }
+    }
+    return *image_;
+  }
+  std::size_t Length() const {
+    auto output = image_ ? image_->Length() * image_->ChannelCount() : 0;
+    if (pixels_) {
+      for (const auto &[id, plane] : pixels_->channels) {
+        output += plane.size();
+      }
+    }
+    return output;
+  }
+  void Unpack() const {
+    if (packed_ && packed_->native && !pixels_) {
+      pixels_ = std::make_shared<const LayerPixels>(DecodePixels(*packed_));
+    }
+  }
+}; // class LayerState
+}; // namespace PSD::detail
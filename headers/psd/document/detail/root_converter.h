@@ -7,6 +7,9 @@
 #include "psd/document/layer.h"
 #include "psd/llapi/structure/info/layer_info.h"
 #include <cassert>
+#include <type_traits>
+#include <utility>
+#include <vector>
 namespace PSD::detail {
 //
 using Root = Group;
@@ -17,15 +20,15 @@ class RootConverter;
 template <>
 class RootConverter<Root> {
 public:
-  llapi::LayerInfo operator()(const Root &input) {
+  llapi::LayerInfo operator()(const Root &input, const ChannelReuse &reuse = ChannelReuse()) {
     llapi::LayerInfo output;
     for (auto entry : input) {
       if (entry->IsLayer()) {
-        ConvertLayer(output, LayerCast(entry));
+        ConvertLayer(output, LayerCast(entry), reuse);
         continue;
       }
       if (entry->IsGroup()) {
-        ConvertGroup(output, GroupCast(entry));
+        ConvertGroup(output, GroupCast(entry), reuse);
         continue;
       }
       assert(false);
@@ -33,42 +36,63 @@ public:
     return output;
   }
 private:
-  void ConvertLayer(llapi::LayerInfo &output, const Layer &input) {
-    output.record.push_back(LayerConverter<Layer>()(input));
+  void ConvertLayer(llapi::LayerInfo &output, const Layer &input, const ChannelReuse &reuse) {
+    output.record.push_back(LayerConverter<Layer>()(input, reuse));
   }
-  void ConvertGroup(llapi::LayerInfo &output, const Group &input) {
-    auto data = GroupConverter<Group>()(input);
+  void ConvertGroup(llapi::LayerInfo &output, const Group &input, const ChannelReuse &reuse) {
+    auto data = GroupConverter<Group>()(input, reuse);
     output.record.insert(output.record.end(), data.begin(), data.end());
   }
 }; // class RootConverter<Root>
 
+// Builds the tree in a single pass over the records. Groups still open are
+// kept on a stack; once its end record is reached a group is moved into
+// the one below, so no entry is ever copied. Layer names are moved out of
+// the records, which are left unusable.
 template <>
 class RootConverter<llapi::LayerInfo> {
 public:
-  Root operator()(const llapi::LayerInfo &input) {
-    Root output;
-    for (auto iterator =  input.record.begin();
-              iterator != input.record.end();) {
-      if (IsLayer(*iterator)) {
-        output.Push(LayerConverter<llapi::LayerRecord>()(*iterator++));
+  Root operator()(llapi::LayerInfo &&input, DecodedLayers *decoded = nullptr) {
+    std::vector<Group> stack(1);
+    for (auto &record : input.record) {
+      if (IsLayer(record)) {
+        stack.back().Push(LayerConverter<llapi::LayerRecord>()(std::move(record), decoded));
         continue;
       }
-      if (IsGroupStart(*iterator)) {
-        auto group = GroupConverter<llapi::LayerRecord>()(
-          iterator,
-          FindGroupEnd(iterator, input.record.end())
-        );
-        iterator += GroupRecordCount(group);
-        output.Push(group);
+      if (IsGroupStart(record)) {
+        stack.emplace_back();
+        continue;
+      }
+      if (IsGroupEnd(record)) {
+        if (stack.size() == 1) throw Error("PSD::Error: UnbalancedGroup");
+        stack.back().SetName(std::move(record.layer_data.name));
+        Close(stack);
         continue;
       }
       assert(false);
     }
-    return output;
+    // Groups left open by a truncated file end with the records.
+    while (stack.size() > 1) {
+      Close(stack);
+    }
+    return std::move(stack.front());
+  }
+private:
+  void Close(std::vector<Group> &stack) {
+    auto group = std::move(stack.back());
+    stack.pop_back();
+    stack.back().Push(std::move(group));
   }
 }; // class RootConverter<llapi::LayerInfo>
 
 template <typename T>
-auto ConvertRoot(const T &root) { return RootConverter<T>()(root); }
+auto ConvertRoot(T &&root) { return RootConverter<std::decay_t<T>>()(std::forward<T>(root)); }
+
+inline llapi::LayerInfo ConvertRoot(const Root &root, const ChannelReuse &reuse) {
+  return RootConverter<Root>()(root, reuse);
+}
+inline Root ConvertRoot(llapi::LayerInfo &&root, DecodedLayers &decoded) {
+  return RootConverter<llapi::LayerInfo>()(std::move(root), &decoded);
+}
 
 }; // PSD::detail
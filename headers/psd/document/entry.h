@@ -10,6 +10,13 @@ using Coordinates = llapi::Coordinates;
 
 class Entry {
 public:
+  Entry() = default;
+  // A copy belongs to no group yet, whatever the source belonged to.
+  Entry(const Entry &) {}
+  Entry &operator=(const Entry &) {
+    InvalidateBounds();
+    return *this;
+  }
   virtual ~Entry() = default;
 
   virtual bool IsGroup() const = 0;
@@ -25,6 +32,25 @@ public:
   virtual unsigned Left()   const = 0;
   virtual unsigned Bottom() const = 0;
   virtual unsigned Right()  const = 0;
+
+  // Area covered by the entry. Groups keep theirs cached, so this is
+  // constant time unless something below changed since the last call.
+  virtual Coordinates Bounds() const = 0;
+protected:
+  // Called whenever the bounds of the entry may have changed. Drops the
+  // cached bounds of every group above; a group that has none cached
+  // cannot have an ancestor with any either, so the walk stops there.
+  void InvalidateBounds() {
+    for (auto entry = parent_; entry && entry->ResetBounds(); entry = entry->parent_) {}
+  }
+  // Drops the cached bounds, returns whether there were any.
+  virtual bool ResetBounds() {
+    return false;
+  }
+private:
+  friend class Group;
+
+  Entry *parent_ = nullptr;
 }; // class Entry
 template <typename T>
 class EntryFor : public Entry {
@@ -3,6 +3,9 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
 #include <psd/document/entry.h>
 
 namespace PSD {
@@ -20,13 +23,46 @@ public:
   Group(std::string name) : name_(name) {}
 
   Group(const Group &other)
-    : name_(other.name_)
-    , data_(other.CloneData()) {}
+    : EntryFor<Group>(other)
+    , name_(other.name_)
+    , data_(other.CloneData()) {
+    Adopt();
+  }
+  Group(Group &&other) noexcept
+    : EntryFor<Group>(other)
+    , name_(std::move(other.name_))
+    , data_(std::move(other.data_)) {
+    Adopt();
+    other.data_.clear();
+    other.Changed();
+  }
+  // Entries handed out by operator[] may outlive the group, they must not
+  // point back at it.
+  ~Group() override {
+    Release();
+  }
 
   Group &operator=(const Group &other) {
     if (this != &other) {
+      EntryFor<Group>::operator=(other);
+      Release();
       name_ = other.name_;
       data_ = other.CloneData();
+      Adopt();
+      Changed();
+    }
+    return *this;
+  }
+  Group &operator=(Group &&other) noexcept {
+    if (this != &other) {
+      EntryFor<Group>::operator=(other);
+      Release();
+      name_ = std::move(other.name_);
+      data_ = std::move(other.data_);
+      Adopt();
+      Changed();
+      other.data_.clear();
+      other.Changed();
     }
     return *this;
   }
@@ -55,29 +91,30 @@ public:
   bool IsLayer() const override final { return false; }
   bool IsGroup() const override final { return true; }
 
-  unsigned Top() const override final {
-    if (Empty()) return 0;
-    return (*std::min_element(begin(), end(), [](const auto &entry, const auto &smallest) {
-      return entry->Top() < smallest->Top();
-    }))->Top();
-  }
-  unsigned Left() const override final {
-    if (Empty()) return 0;
-    return (*std::min_element(begin(), end(), [](const auto &entry, const auto &smallest) {
-      return entry->Left() < smallest->Left();
-    }))->Left();
-  }
-  unsigned Bottom() const override final {
-    if (Empty()) return 0;
-    return (*std::max_element(begin(), end(), [](const auto &largest, const auto &entry) {
-      return largest->Bottom() < entry->Bottom();
-    }))->Bottom();
-  }
-  unsigned Right() const override final {
-    if (Empty()) return 0;
-    return (*std::max_element(begin(), end(), [](const auto &largest, const auto &entry) {
-      return largest->Right() < entry->Right();
-    }))->Right();
+  unsigned Top()    const override final { return Bounds().top;    }
+  unsigned Left()   const override final { return Bounds().left;   }
+  unsigned Bottom() const override final { return Bounds().bottom; }
+  unsigned Right()  const override final { return Bounds().right;  }
+
+  // Safe to call from several threads at once, the cache is filled under a
+  // lock. Edits still need the group and everything below it to themselves.
+  Coordinates Bounds() const override final {
+    std::lock_guard<std::mutex> lock(bounds_mutex_);
+    if (!bounds_) {
+      Coordinates output;
+      if (!Empty()) {
+        output = data_.front()->Bounds();
+        for (const auto &entry : data_) {
+          auto bounds   = entry->Bounds();
+          output.top    = std::min(output.top,    bounds.top);
+          output.left   = std::min(output.left,   bounds.left);
+          output.bottom = std::max(output.bottom, bounds.bottom);
+          output.right  = std::max(output.right,  bounds.right);
+        }
+      }
+      bounds_ = output;
+    }
+    return *bounds_;
   }
   unsigned Length() const {
     return data_.size();
@@ -100,6 +137,8 @@ public:
     data_.push_back(std::static_pointer_cast<Entry>(
       std::make_shared<std::decay_t<T>>(std::forward<T>(entry))
     ));
+    data_.back()->parent_ = this;
+    Changed();
   }
   std::shared_ptr<Entry> operator[](unsigned index) {
     return data_[index];
@@ -119,6 +158,31 @@ public:
 private:
   std::string name_;
   std::vector<std::shared_ptr<Entry>> data_;
+
+  mutable std::optional<Coordinates> bounds_;
+  mutable std::mutex                 bounds_mutex_;
+
+  void Adopt() {
+    for (auto &entry : data_) {
+      entry->parent_ = this;
+    }
+  }
+  void Release() {
+    for (auto &entry : data_) {
+      if (entry->parent_ == this) {
+        entry->parent_ = nullptr;
+      }
+    }
+  }
+  void Changed() {
+    if (ResetBounds()) {
+      InvalidateBounds();
+    }
+  }
+  bool ResetBounds() override final {
+    std::lock_guard<std::mutex> lock(bounds_mutex_);
+    return std::exchange(bounds_, std::nullopt).has_value();
+  }
 }; // class Group
 inline Group &GroupCast(std::shared_ptr<Entry> input) {
   return *std::static_pointer_cast<Group>(input);
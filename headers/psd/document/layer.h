@@ -4,6 +4,10 @@
 #include "psd/llapi/structure/info/layer_info/layer_data.h"
 #include <memory>
 #include <psd/document/entry.h>
+#include <psd/document/detail/layer_decoder.h>
+#include <psd/document/detail/layer_pixels.h>
+#include <psd/document/detail/layer_source.h>
+#include <psd/document/detail/layer_state.h>
 #include <string>
 #include <psd/llapi/structure.h>
 
@@ -11,9 +15,16 @@
 
 namespace PSD {
 //
+class OpenFn;
+
+namespace detail {
+template <typename T>
+class LayerConverter;
+}; // namespace detail
+
 class Layer : public EntryFor<Layer> {
   auto Comparable() const {
-    return std::tie(name_, xoffset_, yoffset_, image_);
+    return std::tie(name_, xoffset_, yoffset_, Image());
   }
 public:
   Layer() = default;
@@ -22,7 +33,7 @@ public:
     : name_(std::move(name)) {}
 
   Layer(std::string name, Image::Buffer<> image)
-    : name_(std::move(name)), image_(std::move(image)) {}
+    : name_(std::move(name)), state_(std::make_shared<detail::LayerState>(std::move(image))) {}
 
   bool IsLayer() const override final { return true; }
   bool IsGroup() const override final { return false; }
@@ -38,10 +49,13 @@ public:
     return llapi::Coordinates{
       yoffset_,
       xoffset_,
-      xoffset_ + image_.RowCount(),
-      yoffset_ + image_.ColumnCount()
+      yoffset_ + RowCount(),
+      xoffset_ + ColumnCount()
     };
   }
+  llapi::Coordinates Bounds() const override final {
+    return Coordinates();
+  }
   unsigned Top()    const override final { return Coordinates().top;    }
   unsigned Left()   const override final { return Coordinates().left;   }
   unsigned Bottom() const override final { return Coordinates().bottom; }
@@ -50,15 +64,93 @@ public:
   void SetOffset(unsigned xoffset, unsigned yoffset) {
     xoffset_ = xoffset;
     yoffset_ = yoffset;
+    InvalidateBounds();
   }
   void SetImage(::Image::Buffer<> image) {
-    image_ = std::move(image);
+    state_    = std::make_shared<detail::LayerState>(std::move(image));
+    modified_ = true;
+    InvalidateBounds();
   }
-  ::Image::Buffer<> &Image() {
-    return image_;
+  // Writable RGBA8 image of a layer, handed back to it when the edit goes
+  // away. The layer counts as modified from then on and its native pixels
+  // are dropped. Pixels shared with copies of the layer are copied for the
+  // edit, otherwise they are moved into it and the layer reads as empty
+  // until the edit is over.
+  class ImageEdit {
+  public:
+    ~ImageEdit() {
+      layer_.SetImage(std::move(image_));
+    }
+    ImageEdit(const ImageEdit &) = delete;
+    ImageEdit &operator=(const ImageEdit &) = delete;
+
+    ::Image::Buffer<> &operator*() {
+      return image_;
+    }
+    ::Image::Buffer<> *operator->() {
+      return &image_;
+    }
+  private:
+    friend class Layer;
+
+    ImageEdit(Layer &layer, ::Image::Buffer<> image)
+      : layer_(layer), image_(std::move(image)) {}
+
+    Layer            &layer_;
+    ::Image::Buffer<> image_;
+  }; // class ImageEdit
+
+  ImageEdit Edit() {
+    if (state_.use_count() == 1) {
+      auto image = state_->TakeImage();
+      state_ = std::make_shared<detail::LayerState>();
+      return ImageEdit(*this, std::move(image));
+    }
+    return ImageEdit(*this, state_->Image());
   }
+  // Decoded or converted from the native pixels on first use, the result
+  // is shared with every copy of the layer.
   const ::Image::Buffer<> &Image() const {
-    return image_;
+    return state_->Image();
+  }
+  // Pixels at the depth and color of the file, kept by OpenOptions::native
+  // until the layer is written to. Null for layers opened otherwise, created
+  // from an image or written to since.
+  const detail::LayerPixels *Pixels() const {
+    return state_->Pixels();
+  }
+  llapi::Depth Depth() const {
+    return state_->Depth();
+  }
+  llapi::Color Color() const {
+    return state_->Color();
+  }
+  // Whether the pixels of a layer opened with OpenOptions::lazy are still
+  // only held compressed.
+  bool Packed() const {
+    return state_->Packed() && !state_->Decoded();
+  }
+  // Whether Evict() has anything to drop.
+  bool Evictable() const {
+    return state_->Packed() && state_->Decoded();
+  }
+  // Bytes taken by the decoded image and native pixels.
+  std::size_t DecodedLength() const {
+    return state_->DecodedLength();
+  }
+  // Drops the decoded pixels of a lazily opened layer that was not written
+  // to, they are decoded again on next use. References returned by Image()
+  // and Pixels() are invalidated, those of copies of the layer are not:
+  // the layer lets go of the state it shares with them and starts over
+  // from the packed channels. Returns the bytes this freed, nothing while
+  // a copy still holds on to them.
+  std::size_t Evict() {
+    if (!Evictable()) {
+      return 0;
+    }
+    auto output = state_.use_count() == 1 ? state_->DecodedLength() : 0;
+    state_ = std::make_shared<detail::LayerState>(state_->Packed());
+    return output;
   }
   void SetName(std::string name) {
     name_ = std::move(name);
@@ -70,10 +162,35 @@ public:
     return name_;
   }
 private:
+  friend class OpenFn;
+  friend class detail::LayerConverter<Layer>;
+  friend class detail::LayerConverter<llapi::LayerRecord>;
+
   std::string name_;
   unsigned xoffset_ = 0;
   unsigned yoffset_ = 0;
-  ::Image::Buffer<> image_;
+
+  // Shared between copies, replaced as a whole whenever the layer is
+  // written to.
+  std::shared_ptr<detail::LayerState> state_ = std::make_shared<detail::LayerState>();
+
+  void SetPixels(std::shared_ptr<const detail::LayerPixels> pixels) {
+    state_ = std::make_shared<detail::LayerState>(std::move(pixels));
+    InvalidateBounds();
+  }
+  void SetPacked(std::shared_ptr<const detail::PackedLayer> packed) {
+    state_ = std::make_shared<detail::LayerState>(std::move(packed));
+    InvalidateBounds();
+  }
+  unsigned RowCount() const {
+    return state_->RowCount();
+  }
+  unsigned ColumnCount() const {
+    return state_->ColumnCount();
+  }
+
+  std::shared_ptr<const detail::LayerSource> source_;
+  bool modified_ = false;
 }; // class Layer
 inline Layer &LayerCast(std::shared_ptr<Entry> input) {
   return *std::static_pointer_cast<Layer>(input);
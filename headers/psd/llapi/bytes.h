@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace PSD::llapi {
+//
+class ByteView {
+public:
+  ByteView() = default;
+  ByteView(const std::uint8_t *data, std::size_t size)
+    : data_(data), size_(size) {}
+  ByteView(const std::vector<std::uint8_t> &input)
+    : data_(input.data()), size_(input.size()) {}
+
+  const std::uint8_t *data()  const { return data_; }
+  std::size_t         size()  const { return size_; }
+  bool                empty() const { return !size_; }
+
+  const std::uint8_t *begin() const { return data_; }
+  const std::uint8_t *end()   const { return data_ + size_; }
+
+  std::uint8_t operator[](std::size_t index) const {
+    return data_[index];
+  }
+private:
+  const std::uint8_t *data_ = nullptr;
+  std::size_t         size_ = 0;
+}; // class ByteView
+
+// Byte buffer that either owns its storage or borrows a range kept alive by
+// a shared owner (a mapped file or a frozen stream buffer). Borrowed bytes
+// are copied into an owned vector only when they are about to be mutated.
+class Bytes {
+public:
+  Bytes() = default;
+  Bytes(std::vector<std::uint8_t> data)
+    : owned_(std::move(data)) {}
+  Bytes(std::shared_ptr<const void> owner, const std::uint8_t *data, std::size_t size)
+    : owner_(std::move(owner)), view_(data, size) {}
+
+  bool operator==(const Bytes &other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+  bool operator!=(const Bytes &other) const {
+    return !operator==(other);
+  }
+  operator ByteView() const {
+    return ByteView(data(), size());
+  }
+  const std::uint8_t *data() const {
+    return owner_ ? view_.data() : owned_.data();
+  }
+  std::size_t size() const {
+    return owner_ ? view_.size() : owned_.size();
+  }
+  bool empty() const {
+    return !size();
+  }
+  const std::uint8_t *begin() const { return data(); }
+  const std::uint8_t *end()   const { return data() + size(); }
+
+  std::uint8_t operator[](std::size_t index) const {
+    return data()[index];
+  }
+  bool Borrowed() const {
+    return owner_ != nullptr;
+  }
+  std::vector<std::uint8_t> &Materialize() {
+    if (owner_) {
+      owned_.assign(view_.begin(), view_.end());
+      owner_.reset();
+      view_ = ByteView();
+    }
+    return owned_;
+  }
+  std::vector<std::uint8_t> Release() && {
+    return std::move(Materialize());
+  }
+private:
+  std::vector<std::uint8_t>   owned_;
+  std::shared_ptr<const void> owner_;
+  ByteView                    view_;
+}; // class Bytes
+}; // namespace PSD::llapi
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <psd/export.h>
+
+namespace PSD::llapi {
+//
+using Job = std::function<void()>;
+
+// Runs batches of independent jobs. Jobs are started in the given order,
+// Run returns once all of them finished and rethrows the first exception
+// a job threw.
+//
+// The library hands its work over as flat batches and never calls Run from
+// inside one of its jobs. Callers' jobs may still do so, an implementation
+// must then not block waiting for threads that are busy with the outer
+// batch, a fixed-size pool would deadlock; running the nested batch on the
+// calling thread is always correct.
+class PSD_EXPORT Executor {
+public:
+  virtual ~Executor() = default;
+  virtual void Run(std::vector<Job> &jobs) = 0;
+}; // class Executor
+
+// Pool of `thread_count - 1` workers started with the executor, the thread
+// calling Run takes jobs as well. Batches from different threads run one
+// after the other, a batch started from inside a job runs inline.
+class PSD_EXPORT ThreadExecutor : public Executor {
+public:
+  ThreadExecutor();
+  ThreadExecutor(unsigned thread_count);
+  ~ThreadExecutor() override;
+
+  ThreadExecutor(const ThreadExecutor &) = delete;
+  ThreadExecutor &operator=(const ThreadExecutor &) = delete;
+
+  void Run(std::vector<Job> &jobs) override;
+
+  unsigned ThreadCount() const {
+    return thread_count_;
+  }
+private:
+  struct Pool;
+
+  unsigned              thread_count_;
+  std::unique_ptr<Pool> pool_;
+}; // class ThreadExecutor
+
+// Process-wide executor using one thread per hardware thread.
+PSD_EXPORT Executor &DefaultExecutor();
+
+// Runs the jobs ordered by their weight, heaviest first, so a big one does
+// not start last and hold up the whole batch.
+inline void RunLargestFirst(std::vector<std::pair<std::uint64_t, Job>> &pending, Executor &executor) {
+  std::stable_sort(pending.begin(), pending.end(), [](const auto &left, const auto &right) {
+    return left.first > right.first;
+  });
+  std::vector<Job> jobs;
+  jobs.reserve(pending.size());
+  for (auto &[size, job] : pending) {
+    jobs.push_back(std::move(job));
+  }
+  executor.Run(jobs);
+}
+}; // namespace PSD::llapi
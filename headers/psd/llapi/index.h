@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdlib>
+#include <psd/llapi/stream.h>
+#include <psd/llapi/structure/header.h>
+#include <psd/llapi/structure/resource_info/resource.h>
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+#include <psd/llapi/structure/info/layer_info/layer_data/layer_data_extra/extra.h>
+#include <vector>
+
+namespace PSD::llapi {
+//
+struct Range {
+  U64 offset = 0;
+  U64 length = 0;
+
+  U64 End() const {
+    return offset + length;
+  }
+  bool operator==(const Range &other) const {
+    return offset == other.offset && length == other.length;
+  }
+  bool operator!=(const Range &other) const {
+    return !operator==(other);
+  }
+}; // struct Range
+struct ResourceEntry {
+  ResourceID id;
+  Range      range;
+}; // struct ResourceEntry
+struct ChannelEntry {
+  I16         id          = 0;
+  Compression compression = Compression::None;
+  Range       range;
+}; // struct ChannelEntry
+struct LayerEntry {
+  Range                     data;
+  std::vector<ChannelEntry> channels;
+}; // struct LayerEntry
+
+// Byte ranges of the sections of a document, gathered by walking the length
+// fields only. Each range starts where the matching FromStreamFn expects
+// the stream to be: `data` reads back as LayerData, a channel as Channel
+// with the range length, `layer16`/`layer32` as LayerInfo with the range
+// length and `image` as Image. Channels are listed in file order.
+class Index {
+  struct FromStreamFn {
+    void operator()(Stream &stream, Index &output) {
+      ReadHeader          (stream, output);
+      ReadColorSection    (stream, output);
+      ReadResourceSection (stream, output);
+      ReadInfoSection     (stream, output);
+      ReadImage           (stream, output);
+    }
+    void ReadHeader(Stream &stream, Index &output) {
+      auto start = stream.Pos();
+      stream.ReadTo(output.header);
+      output.header_section = {start, stream.Pos() - start};
+    }
+    void ReadColorSection(Stream &stream, Index &output) {
+      auto start = stream.Pos();
+      stream += stream.Read<U32>();
+      output.color_section = {start, stream.Pos() - start};
+    }
+    void ReadResourceSection(Stream &stream, Index &output) {
+      auto start = stream.Pos();
+      auto end   = stream.Read<U32>() + stream.Pos();
+      while (stream.Pos() < end) {
+        auto block  = stream.Pos();
+        auto header = stream.Read<ResourceHeader>();
+        stream += header.content_length + header.content_length % 2;
+        output.resources.push_back({header.id, {block, stream.Pos() - block}});
+      }
+      stream.SetPos(end);
+      output.resource_section = {start, end - start};
+    }
+    void ReadInfoSection(Stream &stream, Index &output) {
+      auto start  = stream.Pos();
+      auto length = stream.ReadLength();
+      auto end    = stream.Pos() + length;
+      if (length) {
+        ReadLayerSection(stream, output);
+        stream += stream.Read<U32>(); // skip global info
+        while (stream.Pos() + ExtraHeader().Length() <= end) {
+          auto header  = stream.Read<ExtraHeader>();
+          auto content = stream.Pos();
+          switch (header.id) {
+            case ExtraID::Layer16:
+              output.layer16 = {content, header.content_length};
+              ReadLayers(stream, output, header.content_length);
+              break;
+            case ExtraID::Layer32:
+              output.layer32 = {content, header.content_length};
+              ReadLayers(stream, output, header.content_length);
+              break;
+            default:
+              break;
+          }
+          stream.SetPos(content + header.content_length);
+          while ((stream.Pos() - content) % 4) {
+            stream++;
+          }
+        }
+      }
+      stream.SetPos(end);
+      output.info_section = {start, end - start};
+    }
+    void ReadLayerSection(Stream &stream, Index &output) {
+      auto start  = stream.Pos();
+      auto length = stream.ReadLength();
+      auto end    = stream.Pos() + length;
+      ReadLayers(stream, output, length);
+      stream.SetPos(end);
+      output.layer_section = {start, end - start};
+    }
+    void ReadLayers(Stream &stream, Index &output, U64 length) {
+      if (!length) {
+        return;
+      }
+      std::vector<LayerEntry> layers(std::abs(stream.Read<I16>()));
+      for (auto &layer : layers) {
+        ReadLayerRecord(stream, layer);
+      }
+      for (auto &layer : layers) {
+        for (auto &channel : layer.channels) {
+          channel.range.offset = stream.Pos();
+          if (channel.range.length >= sizeof(Compression)) {
+            stream.ReadTo(channel.compression);
+          }
+          stream.SetPos(channel.range.End());
+        }
+      }
+      output.layers.insert(
+        output.layers.end(),
+        std::make_move_iterator(layers.begin()),
+        std::make_move_iterator(layers.end())
+      );
+    }
+    // Walks the record by its fixed layout instead of reading LayerData, the
+    // channel table has to keep its file order.
+    void ReadLayerRecord(Stream &stream, LayerEntry &output) {
+      auto start = stream.Pos();
+      stream += 16; // coordinates
+      output.channels.resize(stream.Read<U16>());
+      for (auto &channel : output.channels) {
+        stream.ReadTo(channel.id);
+        channel.range.length = stream.ReadLength();
+      }
+      stream += 12; // blending signature, blending, opacity, clipping, flags, filler
+      stream += stream.Read<U32>();
+      output.data = {start, stream.Pos() - start};
+    }
+    void ReadImage(Stream &stream, Index &output) {
+      output.image = {stream.Pos(), stream.Length() - stream.Pos()};
+      if (output.image.length >= sizeof(Compression)) {
+        stream.ReadTo(output.image_compression);
+      }
+    }
+  }; // struct FromStreamFn
+  friend Stream;
+public:
+  Index() = default;
+
+  Header                     header;
+  Range                      header_section;
+  Range                      color_section;
+  Range                      resource_section;
+  std::vector<ResourceEntry> resources;
+  Range                      info_section;
+  Range                      layer_section;
+  Range                      layer16;
+  Range                      layer32;
+  std::vector<LayerEntry>    layers;
+  Range                      image;
+  Compression                image_compression = Compression::None;
+}; // class Index
+
+inline Index IndexFrom(const std::filesystem::path &input) {
+  return Stream(input, Advice::Random).Read<Index>();
+}
+inline Index IndexFrom(std::vector<U8> input) {
+  return Stream(std::move(input)).Read<Index>();
+}
+}; // namespace PSD::llapi
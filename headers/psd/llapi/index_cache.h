@@ -0,0 +1,256 @@
+#pragma once
+
+#include <psd/llapi/index.h>
+#include <psd/llapi/structure.h>
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+
+namespace PSD::llapi {
+//
+template <>
+struct FromStreamFn<Range> {
+  void operator()(Stream &stream, Range &output) {
+    stream.ReadTo(output.offset);
+    stream.ReadTo(output.length);
+  }
+}; // struct FromStreamFn<Range>
+template <>
+struct ToStreamFn<Range> {
+  void operator()(Stream &stream, const Range &input) {
+    stream.Write(input.offset);
+    stream.Write(input.length);
+  }
+}; // struct ToStreamFn<Range>
+template <>
+struct FromStreamFn<ChannelEntry> {
+  void operator()(Stream &stream, ChannelEntry &output) {
+    stream.ReadTo(output.id);
+    stream.ReadTo(output.compression);
+    stream.ReadTo(output.range);
+  }
+}; // struct FromStreamFn<ChannelEntry>
+template <>
+struct ToStreamFn<ChannelEntry> {
+  void operator()(Stream &stream, const ChannelEntry &input) {
+    stream.Write(input.id);
+    stream.Write(input.compression);
+    stream.Write(input.range);
+  }
+}; // struct ToStreamFn<ChannelEntry>
+
+// Identifies the file an index was built from. Files up to 64 KiB are
+// hashed whole. Larger ones only through evenly spaced samples, so the
+// hash stays cheap for multi-gigabyte documents; an edit that misses every
+// sample and keeps both size and mtime goes unnoticed.
+struct CacheKey {
+  U64 size  = 0;
+  I64 mtime = 0;
+  U64 hash  = 0;
+
+  bool operator==(const CacheKey &other) const {
+    return size == other.size && mtime == other.mtime && hash == other.hash;
+  }
+  bool operator!=(const CacheKey &other) const {
+    return !operator==(other);
+  }
+  // Empty when the modification time cannot be read, the file then cannot
+  // be matched against any index.
+  static std::optional<CacheKey> From(const std::filesystem::path &path, Stream &stream) {
+    std::error_code error;
+    auto mtime = std::filesystem::last_write_time(path, error);
+    if (error) {
+      return std::nullopt;
+    }
+    CacheKey output;
+    output.size  = stream.Length();
+    output.mtime = mtime.time_since_epoch().count();
+    output.hash  = SampleHash(stream);
+    return output;
+  }
+private:
+  static constexpr U64 SampleCount  = 16;
+  static constexpr U64 SampleLength = 4096;
+
+  static U64 SampleHash(Stream &stream) {
+    auto position = stream.Pos();
+    auto output   = U64(0xcbf29ce484222325);
+    auto hash = [&](U64 offset, U64 length) {
+      stream.SetPos(offset);
+      for (auto value : stream.Borrow(length)) {
+        output = (output ^ value) * 0x100000001b3;
+      }
+    };
+    if (stream.Length() <= SampleCount * SampleLength) {
+      hash(0, stream.Length());
+    } else {
+      auto step = (stream.Length() - SampleLength) / (SampleCount - 1);
+      for (auto index = 0u; index < SampleCount; index++) {
+        hash(index * step, SampleLength);
+      }
+    }
+    stream.SetPos(position);
+    return output;
+  }
+}; // struct CacheKey
+template <>
+struct FromStreamFn<CacheKey> {
+  void operator()(Stream &stream, CacheKey &output) {
+    stream.ReadTo(output.size);
+    stream.ReadTo(output.mtime);
+    stream.ReadTo(output.hash);
+  }
+}; // struct FromStreamFn<CacheKey>
+template <>
+struct ToStreamFn<CacheKey> {
+  void operator()(Stream &stream, const CacheKey &input) {
+    stream.Write(input.size);
+    stream.Write(input.mtime);
+    stream.Write(input.hash);
+  }
+}; // struct ToStreamFn<CacheKey>
+
+// Sidecar file holding the section index and every layer record of a
+// document, enough to rebuild its layer structure without parsing it.
+class IndexCache {
+  static constexpr U32 Signature = 0x50534458; // PSDX
+  static constexpr U32 Format    = 1;
+
+  // Smallest number of bytes a layer and a channel entry take in the file.
+  static constexpr U64 LayerLength   = sizeof(Range) + sizeof(U16);
+  static constexpr U64 ChannelLength = sizeof(I16) + sizeof(Compression) + sizeof(Range);
+
+  struct FromStreamFn {
+    void operator()(Stream &stream, IndexCache &output) {
+      if (stream.Read<U32>() != Signature ||
+          stream.Read<U32>() != Format) throw Error("PSD::Error: IndexCacheError");
+      stream.ReadTo(output.key);
+      stream.ReadTo(output.index.header);
+      stream.ReadTo(output.index.image);
+      stream.ReadTo(output.index.layer16);
+      stream.ReadTo(output.index.layer32);
+      output.index.layers.resize(ReadCount<U32>(stream, LayerLength));
+      output.layer_data.resize(output.index.layers.size());
+      for (auto position = 0u;
+                position < output.index.layers.size();
+                position++) {
+        auto &layer = output.index.layers[position];
+        stream.ReadTo(layer.data);
+        stream.ReadTo(layer.channels, ReadCount<U16>(stream, ChannelLength));
+        stream.ReadTo(output.layer_data[position]);
+      }
+    }
+    // A stale or damaged sidecar must not make us allocate, every count is
+    // checked against the bytes its entries would need.
+    template <typename T>
+    U64 ReadCount(Stream &stream, U64 entry_length) {
+      auto output = U64(stream.Read<T>());
+      if (output * entry_length > stream.Length() - stream.Pos()) {
+        throw Error("PSD::Error: IndexCacheError");
+      }
+      return output;
+    }
+  }; // struct FromStreamFn
+  struct ToStreamFn {
+    void operator()(Stream &stream, const IndexCache &input) {
+      stream.Write(Signature);
+      stream.Write(Format);
+      stream.Write(input.key);
+      stream.Write(input.index.header);
+      stream.Write(input.index.image);
+      stream.Write(input.index.layer16);
+      stream.Write(input.index.layer32);
+      stream.Write(U32(input.index.layers.size()));
+      for (auto position = 0u;
+                position < input.index.layers.size();
+                position++) {
+        const auto &layer = input.index.layers[position];
+        stream.Write(layer.data);
+        stream.Write(U16(layer.channels.size()));
+        stream.Write(layer.channels);
+        stream.Write(input.layer_data[position]);
+      }
+    }
+  }; // struct ToStreamFn
+  friend Stream;
+public:
+  IndexCache() = default;
+
+  CacheKey               key;
+  Index                  index;
+  std::vector<LayerData> layer_data;
+
+  // Any failure to read the sidecar counts as a miss.
+  static std::optional<IndexCache> Load(const std::filesystem::path &path, const CacheKey &key) {
+    try {
+      auto output = Stream(path).Read<IndexCache>();
+      if (output.key == key) {
+        return output;
+      }
+    } catch (...) {}
+    return std::nullopt;
+  }
+  // The sidecar is only an optimization, failing to write it is ignored.
+  // The old one stays in place until the new one replaces it whole.
+  void Store(const std::filesystem::path &path) const {
+    try {
+      Sink   sink(path);
+      Stream stream(sink);
+      stream.Write(*this);
+      stream.Flush();
+      sink.Commit();
+    } catch (...) {}
+  }
+  // Rebuilds the structure from the cached records, only the channel
+  // payloads are taken from `stream`, borrowed without copying.
+  Structure ToStructure(Stream &stream) const {
+    Structure output;
+    output.header = index.header;
+    stream.SetVersion(output.header.version);
+
+    LayerInfo layer_info;
+    layer_info.record.resize(index.layers.size());
+    for (auto position = 0u;
+              position < layer_info.record.size();
+              position++) {
+      auto &record = layer_info.record[position];
+      record.layer_data = layer_data[position];
+      for (const auto &channel : index.layers[position].channels) {
+        stream.SetPos(channel.range.offset);
+        stream.ReadTo(record.channel_data.data[channel.id], channel.range.length);
+      }
+    }
+    if (index.layer16.length) {
+      output.info.extra_info.Insert(Layer16(std::move(layer_info)));
+    } else if (index.layer32.length) {
+      output.info.extra_info.Insert(Layer32(std::move(layer_info)));
+    } else {
+      output.info.layer_info = std::move(layer_info);
+    }
+    return output;
+  }
+}; // class IndexCache
+
+// Reads the layer structure of `input`, going through the sidecar index at
+// `index` when it matches the file and rewriting it when it does not.
+inline Structure StructureFrom(const std::filesystem::path &input, const std::filesystem::path &index) {
+  Stream stream(input, Advice::Random);
+  auto key = CacheKey::From(input, stream);
+  if (!key) {
+    return stream.Read<Structure>();
+  }
+  if (auto cache = IndexCache::Load(index, *key)) {
+    return cache->ToStructure(stream);
+  }
+  IndexCache cache;
+  cache.key   = *key;
+  cache.index = stream.Read<Index>();
+  for (const auto &layer : cache.index.layers) {
+    stream.SetPos(layer.data.offset);
+    cache.layer_data.push_back(stream.Read<LayerData>());
+  }
+  cache.Store(index);
+  return cache.ToStructure(stream);
+}
+}; // namespace PSD::llapi
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include <psd/export.h>
+
+namespace PSD::llapi {
+//
+enum class Advice {
+  Sequential,
+  Random,
+}; // enum class Advice
+
+// Read-only view of a whole file mapped into memory. Pages are faulted in
+// on first access, so opening is proportional to the part actually read.
+class PSD_EXPORT Mapping {
+public:
+  Mapping(const std::filesystem::path &path, Advice advice = Advice::Sequential);
+  ~Mapping();
+
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+
+  const std::uint8_t *Data() const {
+    return data_;
+  }
+  std::size_t Length() const {
+    return length_;
+  }
+  void Advise(Advice advice, std::size_t offset, std::size_t length) const;
+private:
+  const std::uint8_t *data_   = nullptr;
+  std::size_t         length_ = 0;
+  #ifdef _WIN32
+  void *file_    = nullptr;
+  void *handle_  = nullptr;
+  #endif
+}; // class Mapping
+}; // namespace PSD::llapi
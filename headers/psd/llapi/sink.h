@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+#include <psd/export.h>
+
+namespace PSD::llapi {
+//
+// Write-only file target. Bytes are appended in order, and ranges that were
+// already written can be overwritten in place to fill in deferred lengths.
+// Everything goes to a temporary file next to `path`, which only replaces
+// it on Commit. A sink destroyed without committing, say because the save
+// threw half way, removes the temporary file and leaves `path` untouched;
+// readers still mapping the old file keep seeing it whole. A symbolic link
+// at `path` is followed, and the new file takes over the owner and mode of
+// the one it replaces. Other hard links keep the old contents.
+class PSD_EXPORT Sink {
+public:
+  Sink(const std::filesystem::path &path);
+  ~Sink();
+
+  Sink(const Sink &) = delete;
+  Sink &operator=(const Sink &) = delete;
+
+  void Append(const std::uint8_t *data, std::size_t length);
+  void WriteAt(std::uint64_t offset, const std::uint8_t *data, std::size_t length);
+  // Moves the written file over `path`. Nothing can be written after.
+  void Commit();
+
+  std::uint64_t Length() const {
+    return length_;
+  }
+private:
+  std::filesystem::path path_;
+  std::filesystem::path temporary_;
+  std::uint64_t length_ = 0;
+  #ifdef _WIN32
+  void *file_ = nullptr;
+  #else
+  int descriptor_ = -1;
+  #endif
+}; // class Sink
+}; // namespace PSD::llapi
@@ -3,14 +3,19 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
 
 #include <initializer_list>
 #include <iterator>
 #include <map>
+#include <memory>
 #include <psd/error.h>
+#include <psd/export.h>
+#include <psd/llapi/bytes.h>
+#include <psd/llapi/mapping.h>
+#include <psd/llapi/sink.h>
 #include <type_traits>
-#include <file/input.h>
 #include <file/output.h>
 #include <utility>
 #include <vector>
@@ -55,6 +60,11 @@ using I64 = std::int64_t;
 using F32 = float;
 using F64 = double;
 
+enum class Version : U16 {
+  PSD = 1,
+  PSB = 2,
+}; // enum class Version
+
 namespace detail {
 //
 template <typename T>
@@ -174,6 +184,29 @@ inline constexpr T SwapLE(T value) {
 template <typename T>
 static constexpr bool ByteSwapSupported = std::is_integral_v<T> || std::is_floating_point_v<T>;
 
+PSD_EXPORT void ByteSwapCopy16(const void *input, void *output, std::size_t count);
+PSD_EXPORT void ByteSwapCopy32(const void *input, void *output, std::size_t count);
+PSD_EXPORT void ByteSwapCopy64(const void *input, void *output, std::size_t count);
+
+// Copies `count` values of T between big-endian and native order, input
+// and output may be the same range.
+template <typename T>
+inline void SwapRangeLE(const void *input, void *output, std::size_t count) {
+  #ifdef PSD_LITTLE_ENDIAN
+    if constexpr (sizeof(T) == 2) {
+      ByteSwapCopy16(input, output, count);
+    } else if constexpr (sizeof(T) == 4) {
+      ByteSwapCopy32(input, output, count);
+    } else if constexpr (sizeof(T) == 8) {
+      ByteSwapCopy64(input, output, count);
+    } else {
+      std::memmove(output, input, count * sizeof(T));
+    }
+  #else
+    std::memmove(output, input, count * sizeof(T));
+  #endif
+}
+
 template <typename T>
 using IteratorValue = typename std::iterator_traits<T>::value_type;
 
@@ -186,6 +219,14 @@ static constexpr bool SupportedIterator =
    std::is_same_v<IteratorCategory<T>, std::bidirectional_iterator_tag> ||
    std::is_same_v<IteratorCategory<T>, std::random_access_iterator_tag>);
 
+// Contiguous ranges of multi-byte values are swapped in bulk.
+template <typename T, typename V = IteratorValue<T>>
+static constexpr bool BulkSwapSupported =
+  ByteSwapSupported<V> && sizeof(V) > 1 &&
+  (std::is_pointer_v<T> ||
+   std::is_same_v<T, typename std::vector<V>::iterator> ||
+   std::is_same_v<T, typename std::vector<V>::const_iterator>);
+
 } // namespace detail
 class Stream {
   template <typename V, typename T, typename F, typename... A>
@@ -274,12 +315,22 @@ class Stream {
 public:
   Stream() = default;
 
-  Stream(const std::filesystem::path &path)
-    : buffer_(File::From(path)) {}
+  Stream(const std::filesystem::path &path, Advice advice = Advice::Sequential) {
+    auto mapping = std::make_shared<const Mapping>(path, advice);
+    mapping_ = mapping.get();
+    data_    = mapping->Data();
+    length_  = mapping->Length();
+    storage_ = std::move(mapping);
+  }
 
   Stream(std::vector<U8> data)
     : buffer_(std::move(data)) {}
 
+  // Write-only stream that hands its buffer to `sink` whenever it grows past
+  // FlushThreshold, so memory stays bounded however large the output is.
+  Stream(Sink &sink)
+    : sink_(&sink) {}
+
   Stream(std::initializer_list<U8> data)
     : buffer_(std::move(data)) {}
 
@@ -289,7 +340,7 @@ public:
     if (Overflow(sizeof(T))) {
       throw Error("Stream::NotEnoughData");
     }
-    return detail::SwapLE(Access<T>());
+    return detail::SwapLE(Fetch<T>());
   }
   template <typename T, typename... A>
   std::enable_if_t<
@@ -321,6 +372,7 @@ public:
   template <typename T>
   std::enable_if_t<detail::ByteSwapSupported<T>>
   Write(T value) {
+    Detach();
     if (Overflow(sizeof(T))) {
       AdjustBuffer(sizeof(T));
     }
@@ -343,14 +395,25 @@ public:
     !ToStreamFnImplementedInClass <typename I::value_type, I, I>>
   Read(I begin, I end) {
     auto distance = std::distance(begin, end);
+    using Value = detail::IteratorValue<I>;
+    if constexpr (detail::BulkSwapSupported<I>) {
+      const auto length = distance * sizeof(Value);
+      if (Overflow(length)) {
+        throw Error("Stream::NotEnoughData");
+      }
+      if (distance) {
+        detail::SwapRangeLE<Value>(Data() + offset_, &*begin, distance);
+        offset_ += length;
+      }
+      return;
+    }
     if (Overflow(distance)) {
       throw Error("Stream::NotEnoughData");
     }
-    using Value = detail::IteratorValue<I>;
     if constexpr (
       std::is_same_v<Value, U8> ||
       std::is_same_v<Value, I8>) {
-        auto current = reinterpret_cast<Value *>(buffer_.data() + offset_);
+        auto current = reinterpret_cast<const Value *>(Data() + offset_);
         std::copy(current, current + distance, begin);
         offset_ += distance;
     } else {
@@ -362,11 +425,23 @@ public:
   template <typename I>
   std::enable_if_t<detail::SupportedIterator<I>>
   Write(I begin, I end) {
+    Detach();
     const auto distance = std::distance(begin, end);
+    using Value = detail::IteratorValue<I>;
+    if constexpr (detail::BulkSwapSupported<I>) {
+      const auto length = distance * sizeof(Value);
+      if (Overflow(length)) {
+        AdjustBuffer(length);
+      }
+      if (distance) {
+        detail::SwapRangeLE<Value>(&*begin, Current<U8>(), distance);
+        offset_ += length;
+      }
+      return;
+    }
     if (Overflow(distance)) {
       AdjustBuffer(distance);
     }
-    using Value = detail::IteratorValue<I>;
     if constexpr (
       std::is_same_v<Value, U8> ||
       std::is_same_v<Value, I8>) {
@@ -380,10 +455,10 @@ public:
     }
   }
 
-  void operator+=(unsigned value) {
+  void operator+=(U64 value) {
     offset_ += value;
   }
-  void operator-=(unsigned value) {
+  void operator-=(U64 value) {
     offset_ -= value;
   }
   void operator++() {
@@ -398,46 +473,196 @@ public:
   void operator--(int) {
     offset_--;
   }
-  void SetPos(unsigned value) {
+  void SetPos(U64 value) {
     offset_ = value;
   }
-  unsigned Pos() const {
+  U64 Pos() const {
+    return offset_;
+  }
+  U64 Length() const {
+    return storage_ ? length_ : base_ + buffer_.size();
+  }
+  // Set by the header, PSB widens section and channel lengths to 8 bytes.
+  void SetVersion(Version version) {
+    version_ = version;
+  }
+  bool Large() const {
+    return version_ == Version::PSB;
+  }
+  U64 ReadLength(bool large) {
+    return large ? Read<U64>() : Read<U32>();
+  }
+  U64 ReadLength() {
+    return ReadLength(Large());
+  }
+  void WriteLength(U64 value, bool large) {
+    if (large) {
+      Write<U64>(value);
+    } else if (value > UINT32_MAX) {
+      throw Error("PSD::Error: LengthError");
+    } else {
+      Write<U32>(value);
+    }
+  }
+  void WriteLength(U64 value) {
+    WriteLength(value, Large());
+  }
+  // Writes a zero length and returns where the content it measures starts,
+  // PatchLength later fills in the number of bytes written since then.
+  U64 ReserveLength(bool large) {
+    WriteLength(0, large);
     return offset_;
   }
-  unsigned Length() const {
-    return buffer_.size();
+  U64 ReserveLength() {
+    return ReserveLength(Large());
+  }
+  void PatchLength(U64 start, bool large) {
+    auto length = offset_ - start;
+    if (large) {
+      Patch<U64>(start - sizeof(U64), length);
+    } else if (length > UINT32_MAX) {
+      throw Error("PSD::Error: LengthError");
+    } else {
+      Patch<U32>(start - sizeof(U32), length);
+    }
+  }
+  void PatchLength(U64 start) {
+    PatchLength(start, Large());
+  }
+  bool Mapped() const {
+    return mapping_ != nullptr;
+  }
+  void Advise(Advice advice) const {
+    if (mapping_) {
+      mapping_->Advise(advice, offset_, Length() - offset_);
+    }
+  }
+  // Appends raw bytes, large runs skip the buffer when writing to a sink.
+  void Write(ByteView input) {
+    if (sink_ && input.size() >= FlushThreshold && offset_ == Length()) {
+      Flush();
+      sink_->Append(input.data(), input.size());
+      base_   += input.size();
+      offset_ += input.size();
+    } else {
+      Write(input.begin(), input.end());
+    }
+  }
+  // Hands everything buffered to the sink. Only valid at the end of the
+  // written data, a no-op for streams without a sink.
+  void Flush() {
+    if (sink_ && !buffer_.empty()) {
+      sink_->Append(buffer_.data(), buffer_.size());
+      base_ += buffer_.size();
+      buffer_.clear();
+    }
+  }
+  // Returns the next `length` bytes without copying them. The result keeps
+  // the underlying mapping or buffer alive for as long as it is referenced.
+  Bytes Borrow(U64 length) {
+    if (Overflow(length)) {
+      throw Error("Stream::NotEnoughData");
+    }
+    Share();
+    auto output = Bytes(storage_, data_ + offset_, length);
+    offset_ += length;
+    return output;
   }
   void Dump(const std::filesystem::path &path) const {
-    File::To(buffer_, path);
+    if (storage_) {
+      File::To(std::vector<U8>(Data(), Data() + Length()), path);
+    } else {
+      File::To(buffer_, path);
+    }
   }
   void Dump(std::vector<U8> &output) const {
-    output = buffer_;
+    output.assign(Data(), Data() + Length());
   }
 private:
-  std::vector<U8> buffer_; unsigned offset_ = 0;
+  std::vector<U8> buffer_; U64 offset_ = 0;
+  Version version_ = Version::PSD;
+
+  static constexpr std::size_t FlushThreshold = 1 << 20;
+
+  Sink *sink_ = nullptr;
+  U64   base_ = 0;
+
+  std::shared_ptr<const void> storage_;
+  const Mapping *mapping_ = nullptr;
+  const U8      *data_    = nullptr;
+  std::size_t    length_  = 0;
+
+  const U8 *Data() const {
+    return storage_ ? data_ : buffer_.data();
+  }
+  // Shared storage is read-only, writing falls back to an owned copy.
+  void Detach() {
+    if (storage_) {
+      buffer_.assign(data_, data_ + length_);
+      storage_.reset();
+      mapping_ = nullptr;
+      data_    = nullptr;
+      length_  = 0;
+    }
+  }
+  void Share() {
+    if (!storage_) {
+      auto shared = std::make_shared<const std::vector<U8>>(std::move(buffer_));
+      buffer_.clear();
+      data_    = shared->data();
+      length_  = shared->size();
+      storage_ = std::move(shared);
+    }
+  }
 
-  void AdjustBuffer(unsigned length) {
-    buffer_.resize(offset_ + length);
+  void AdjustBuffer(U64 length) {
+    if (sink_ && buffer_.size() >= FlushThreshold && offset_ >= Length()) {
+      Flush();
+    }
+    buffer_.resize(offset_ - base_ + length);
+  }
+  // Overwrites an earlier value, through the sink if it was flushed already.
+  template <typename T>
+  void Patch(U64 position, T value) {
+    if (position < base_) {
+      if (position + sizeof(T) > base_) {
+        Flush();
+      }
+      value = detail::SwapLE(value);
+      sink_->WriteAt(position, reinterpret_cast<const U8 *>(&value), sizeof(T));
+      return;
+    }
+    auto end = offset_;
+    offset_  = position;
+    Write(value);
+    offset_  = end;
   }
 
-  bool Overflow(unsigned required) {
-    return offset_ + required > buffer_.size();
+  bool Overflow(U64 required) {
+    return offset_ + required > Length();
   }
 
   template <typename T>
   T *Current() {
-    return reinterpret_cast<T *>(buffer_.data() + offset_);
+    return reinterpret_cast<T *>(buffer_.data() + (offset_ - base_));
+  }
+  template <typename T>
+  T Fetch() {
+    T output;
+    std::memcpy(&output, Data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return output;
   }
   template <typename T>
   T &Access() {
     return *reinterpret_cast<T *>(
-      buffer_.data() + (offset_ += sizeof(T)) - sizeof(T)
+      buffer_.data() + (offset_ += sizeof(T)) - sizeof(T) - base_
     );
   }
 };
 template <typename T>
 struct FromStreamFn<std::vector<T>> {
-  void operator()(Stream &stream, std::vector<T> &output, unsigned length) {
+  void operator()(Stream &stream, std::vector<T> &output, U64 length) {
     output.resize(length);
     stream.Read(
       output.begin(),
@@ -448,15 +673,31 @@ struct FromStreamFn<std::vector<T>> {
 template <typename T>
 struct ToStreamFn<std::vector<T>> {
   void operator()(Stream &stream, const std::vector<T> &input) {
-    stream.Write(
-      input.begin(),
-      input.end()
-    );
+    if constexpr (std::is_same_v<T, U8>) {
+      stream.Write(ByteView(input));
+    } else {
+      stream.Write(
+        input.begin(),
+        input.end()
+      );
+    }
   }
 }; // struct ToStreamFn<std::vector<T>>
+template <>
+struct FromStreamFn<Bytes> {
+  void operator()(Stream &stream, Bytes &output, U64 length) {
+    output = stream.Borrow(length);
+  }
+}; // struct FromStreamFn<Bytes>
+template <>
+struct ToStreamFn<Bytes> {
+  void operator()(Stream &stream, const Bytes &input) {
+    stream.Write(ByteView(input));
+  }
+}; // struct ToStreamFn<Bytes>
 template <typename T>
 struct FromStreamFn<std::basic_string<T>> {
-  void operator()(Stream &stream, std::basic_string<T> &output, unsigned length) {
+  void operator()(Stream &stream, std::basic_string<T> &output, U64 length) {
     output.resize(length);
     stream.Read(
       output.begin(),
@@ -489,8 +730,8 @@ struct ToStreamFn<std::pair<F, S>> {
 }; // struct ToStreamFn<std::pair<F, S>>
 template <typename K, typename V>
 struct FromStreamFn<std::map<K, V>> {
-  void operator()(Stream &stream, std::map<K, V> &output, unsigned length) {
-    for (auto index = 0u;
+  void operator()(Stream &stream, std::map<K, V> &output, U64 length) {
+    for (auto index = U64(0);
               index < length;
               index++) {
       output[stream.Read<K>()] = stream.Read<V>();
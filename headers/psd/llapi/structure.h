@@ -47,20 +47,26 @@ public:
   ResourceInfo resource_info;
   Info         info;
   Image        image;
-  void Decompress() {
-    info.Decompress(header);
+  void Decompress(Executor &executor = DefaultExecutor()) {
+    info.Decompress(header, executor);
     image.Decompress(header);
   }
-  void Compress(Compression compression, unsigned level) {
-    info.layer_info.Compress(compression, level, header);
-    image.Compress(compression, level, header);
+  void Compress(
+    Compression                          compression,
+    unsigned                             level,
+    Executor                            &executor = DefaultExecutor(),
+    const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+  ) {
+    info.Compress(compression, level, header, executor, adaptive);
+    image.Compress(compression, level, header, executor, adaptive);
   }
 }; // class Structure
 
 inline Structure ConvertColor(Structure input, Color color) {
   ConvertColorInPlace(input.info  , input.header.color , color);
   ConvertColorInPlace(input.image , input.header.color , color);
-  input.header.color = color;
+  input.header.color         = color;
+  input.header.channel_count = color == Color::Grayscale ? 1 : 3;
   return input;
 }
 inline Structure ConvertDepth(Structure input, Depth depth) {
@@ -75,33 +81,81 @@ inline void ConvertColorInPlace(Structure &output, Color color) {
 inline void ConvertDepthInPlace(Structure &output, Depth depth) {
   output = ConvertDepth(std::move(output), depth);
 }
-inline Structure Decompress(Structure input) {
-  DecompressInPlace(input.info, input.header);
+inline Structure Decompress(Structure input, Executor &executor = DefaultExecutor()) {
+  DecompressInPlace(input.info, input.header, executor);
   input.image.Decompress(input.header);
   return input;
 }
-inline void DecompressInPlace(Structure &output) {
-  output = Decompress(std::move(output));
+inline void DecompressInPlace(Structure &output, Executor &executor = DefaultExecutor()) {
+  output = Decompress(std::move(output), executor);
 }
-inline void CompressInPlace(Structure &output, Compression compression, unsigned level = 6) {
-  output.Compress(compression, level);
+inline void CompressInPlace(
+  Structure                           &output,
+  Compression                          compression,
+  unsigned                             level    = 6,
+  Executor                            &executor = DefaultExecutor(),
+  const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+) {
+  output.Compress(compression, level, executor, adaptive);
 }
-inline Structure Compress(Structure input, Compression compression, unsigned level = 6) {
+inline Structure Compress(
+  Structure                            input,
+  Compression                          compression,
+  unsigned                             level    = 6,
+  Executor                            &executor = DefaultExecutor(),
+  const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+) {
   Structure output = std::move(input);
-  CompressInPlace(output, compression, level);
+  CompressInPlace(output, compression, level, executor, adaptive);
+  return output;
+}
+struct CompressionTally {
+  unsigned channel_count = 0;
+  U64      length        = 0;
+}; // struct CompressionTally
+
+// Channel count and stored bytes per codec, over the layer channels of
+// every depth and the composite image, which counts as one channel.
+using CompressionStatistics = std::map<Compression, CompressionTally>;
+
+inline CompressionStatistics StatisticsOf(const Structure &input) {
+  CompressionStatistics output;
+  auto tally = [&](const LayerInfo &layer_info) {
+    for (const auto &record : layer_info.record) {
+      for (const auto &[id, channel] : record.channel_data.data) {
+        auto &entry = output[channel.compression];
+        entry.channel_count++;
+        entry.length += channel.data.size();
+      }
+    }
+  };
+  tally(input.info.layer_info);
+  if (input.info.extra_info.Exists<Layer16>()) {
+    tally(input.info.extra_info.At<Layer16>().data);
+  }
+  if (input.info.extra_info.Exists<Layer32>()) {
+    tally(input.info.extra_info.At<Layer32>().data);
+  }
+  if (!input.image.data.empty()) {
+    auto &entry = output[input.image.compression];
+    entry.channel_count++;
+    entry.length += input.image.data.size();
+  }
   return output;
 }
 
 inline Structure StructureFrom(const std::filesystem::path &input) {
-  return Stream(input).Read<Structure>();
+  return Stream(input, Advice::Sequential).Read<Structure>();
 }
 inline Structure StructureFrom(std::vector<U8> input) {
-  return Stream(input).Read<Structure>();
+  return Stream(std::move(input)).Read<Structure>();
 }
 inline void DumpStructure(const Structure &input, const std::filesystem::path &output) {
-  Stream stream;
+  Sink   sink(output);
+  Stream stream(sink);
   stream.Write(input);
-  stream.Dump(output);
+  stream.Flush();
+  sink.Commit();
 }
 inline void DumpStructure(const Structure &input, std::vector<U8> &output) {
   Stream stream;
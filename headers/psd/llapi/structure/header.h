@@ -9,10 +9,6 @@
 
 namespace PSD::llapi {
 //
-enum class Version : U16 {
-  PSD = 1,
-  PSB = 2,
-};
 template <>
 struct FromStreamFn<Version> {
   void operator()(Stream &stream, Version &version) {
@@ -89,10 +85,14 @@ class Header {
       stream.ReadTo(header.column_count);
       stream.ReadTo(header.depth);
       stream.ReadTo(header.color);
+      header.Validate();
+      stream.SetVersion(header.version);
     }
   };
   struct ToStreamFn {
     void operator()(Stream &stream, const Header &header) {
+      header.Validate();
+      stream.SetVersion(header.version);
       stream.Write<U32>(0x38425053);
       stream.Write(header.version);
       stream.Write<U32>(0x00);
@@ -129,5 +129,19 @@ public:
   std::uint32_t column_count  = 0;
   Depth         depth         = Depth::Eight;
   Color         color         = Color::Rgb;
+
+  static constexpr std::uint32_t MaxDimension(Version version) {
+    return version == Version::PSB ? 300000 : 30000;
+  }
+  // Smallest version able to hold a document of the given size.
+  static constexpr Version VersionFor(std::uint32_t row_count, std::uint32_t column_count) {
+    return row_count    > MaxDimension(Version::PSD) ||
+           column_count > MaxDimension(Version::PSD) ? Version::PSB : Version::PSD;
+  }
+private:
+  void Validate() const {
+    if (row_count    > MaxDimension(version) ||
+        column_count > MaxDimension(version)) throw Error("PSD::Error: DimensionError");
+  }
 }; // class Header
 }; // namespace PSD::llapi
@@ -24,10 +24,11 @@ class Image {
   friend Stream;
 public:
   Image() = default;
+  Image(Bytes data) : data(std::move(data)) {}
   Image(std::vector<U8> data) : data(std::move(data)) {}
 
-  Compression     compression = Compression::None;
-  std::vector<U8> data;
+  Compression compression = Compression::None;
+  Bytes       data;
 
   void Decompress(const llapi::Header &header) {
     if (data.empty() || compression == Compression::None) {
@@ -38,23 +39,43 @@ public:
       header.row_count * header.channel_count,
       header.column_count,
       header.depth,
-      compression
+      compression,
+      header.version
     );
     compression = Compression::None;
   }
-  void Compress(Compression compr, unsigned level, const Header &header) {
-    if (data.empty() || compr == Compression::None) {
-      return;
-    } else {
-      data = llapi::CompressDefault(
+  void Compress(
+    Compression                          compr,
+    unsigned                             level,
+    const Header                        &header,
+    Executor                            &executor = DefaultExecutor(),
+    const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+  ) {
+    if (adaptive) {
+      compr = ChooseCompression(
         data,
         header.row_count * header.channel_count,
         header.column_count,
         header.depth,
-        level
+        level,
+        header.version,
+        *adaptive
       );
-      compression = Compression::Default;
     }
+    if (data.empty() || compr == Compression::None) {
+      return;
+    }
+    data = llapi::Compress(
+      data,
+      header.row_count * header.channel_count,
+      header.column_count,
+      header.depth,
+      compr,
+      level,
+      header.version,
+      &executor
+    );
+    compression = compr;
   }
 }; // class Image
 namespace detail {
@@ -62,7 +83,10 @@ namespace detail {
 class ConvertImageDepthFn {
 public:
   Image operator()(Image input, Depth input_depth, Depth output_depth) {
-    return ConvertDepth(input.data, input_depth, output_depth);
+    if (input_depth == output_depth) {
+      return input;
+    }
+    return ConvertDepth(std::move(input.data).Release(), input_depth, output_depth);
   }
 };
 class ConvertImageColorFn {
@@ -77,30 +101,28 @@ public:
     );
   }
 private:
+  // The composite is planar, one whole plane after the other.
   Image ToGrayscale(Image input) const {
-    Image output(std::vector<U8>(input.data.size() / 3));
-    for (auto index = 0u;
-              index < input.data.size() / 3;
+    auto length = input.data.size() / 3;
+    std::vector<U8> output(length);
+    for (auto index = std::size_t(0);
+              index < length;
               index++) {
-      auto offset = index * 3;
-      output.data[index] =
-        0.299 * input.data[offset + 0] +
-        0.587 * input.data[offset + 1] +
-        0.114 * input.data[offset + 2];
+      output[index] = U8(
+        0.299 * input.data[index             ] +
+        0.587 * input.data[index + length    ] +
+        0.114 * input.data[index + length * 2] + 0.5
+      );
     }
-    return output;
+    return Image(std::move(output));
   }
   Image FromGrayscale(Image input) const {
-    Image output(std::vector<U8>(input.data.size() * 3));
-    for (auto index = 0u;
-              index < input.data.size() * 3;
-              index++) {
-      auto offset = index / 3;
-      output.data[index + 0] = input.data[offset];
-      output.data[index + 1] = input.data[offset];
-      output.data[index + 2] = input.data[offset];
+    auto length = input.data.size();
+    std::vector<U8> output(length * 3);
+    for (auto plane = 0u; plane < 3; plane++) {
+      std::copy(input.data.begin(), input.data.end(), output.begin() + plane * length);
     }
-    return output;
+    return Image(std::move(output));
   }
   Image FromColor(Image input, Color input_color) const {
     switch (input_color) {
@@ -11,21 +11,21 @@ namespace PSD::llapi {
 class Info {
   struct FromStreamFn {
     void operator()(Stream &stream, Info &output) {
-      auto length = stream.Read<U32>();
+      auto length = stream.ReadLength();
       auto start  = stream.Pos();
 
       stream.ReadTo(output.layer_info);
-      // stream += (start - stream.Pos()) % 4;
       stream.ReadTo(output.global_info);
       stream.ReadTo(output.extra_info, length - (stream.Pos() - start));
     }
   }; // struct FromStreamFn
   struct ToStreamFn {
     void operator()(Stream &stream, const Info &input) {
-      stream.Write(input.ContentLength());
+      auto start = stream.ReserveLength();
       stream.Write(input.layer_info);
       stream.Write(input.global_info);
       stream.Write(input.extra_info);
+      stream.PatchLength(start);
     }
   }; // struct ToStreamFn
   friend Stream;
@@ -45,23 +45,29 @@ public:
       layer_info = std::move(extra_info.At<Layer32>().data);
     }
   }
-  void Decompress(const Header &header) {
+  void Decompress(const Header &header, Executor &executor = DefaultExecutor()) {
     if (extra_info.Exists<Layer16>()) {
-      return extra_info.At<Layer16>().data.Decompress(header);
+      return extra_info.At<Layer16>().data.Decompress(header, executor);
     }
     if (extra_info.Exists<Layer32>()) {
-      return extra_info.At<Layer32>().data.Decompress(header);
+      return extra_info.At<Layer32>().data.Decompress(header, executor);
     }
-    layer_info.Decompress(header);
+    layer_info.Decompress(header, executor);
   }
-  void Compress(Compression compression, unsigned level, const Header &header) {
+  void Compress(
+    Compression                          compression,
+    unsigned                             level,
+    const Header                        &header,
+    Executor                            &executor = DefaultExecutor(),
+    const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+  ) {
     if (extra_info.Exists<Layer16>()) {
-      return extra_info.At<Layer16>().data.Compress(compression, level, header);
+      return extra_info.At<Layer16>().data.Compress(compression, level, header, executor, adaptive);
     }
     if (extra_info.Exists<Layer32>()) {
-      return extra_info.At<Layer32>().data.Compress(compression, level, header);
+      return extra_info.At<Layer32>().data.Compress(compression, level, header, executor, adaptive);
     }
-    layer_info.Compress(compression, level, header);
+    layer_info.Compress(compression, level, header, executor, adaptive);
   }
   unsigned Length() const {
     return 4 + ContentLength();
@@ -124,18 +130,18 @@ inline Info ConvertDepth(Info input, Depth output_depth) {
   ConvertDepthInPlace(output, output_depth);
   return output;
 }
-inline Info Decompress(Info input, const Header &header) {
-  input.Decompress(header);
+inline Info Decompress(Info input, const Header &header, Executor &executor = DefaultExecutor()) {
+  input.Decompress(header, executor);
   return input;
 }
-inline void DecompressInPlace(Info &output, const Header &header) {
-  output = Decompress(std::move(output), header);
+inline void DecompressInPlace(Info &output, const Header &header, Executor &executor = DefaultExecutor()) {
+  output = Decompress(std::move(output), header, executor);
 }
-inline Info Compress(Info input, const Header &header, Compression compression, unsigned level) {
-  input.Compress(compression, level, header);
+inline Info Compress(Info input, const Header &header, Compression compression, unsigned level, Executor &executor = DefaultExecutor()) {
+  input.Compress(compression, level, header, executor);
   return input;
 }
-inline void CompressInPlace(Info &output, const Header &header, Compression compression, unsigned level) {
-  output = Compress(std::move(output), header, compression, level);
+inline void CompressInPlace(Info &output, const Header &header, Compression compression, unsigned level, Executor &executor = DefaultExecutor()) {
+  output = Compress(std::move(output), header, compression, level, executor);
 }
 }; // namespace PSD::llapi
@@ -9,7 +9,7 @@ namespace PSD::llapi {
 //
 class InfoExtra {
   struct FromStreamFn {
-    void operator()(Stream &stream, InfoExtra &output, unsigned length) {
+    void operator()(Stream &stream, InfoExtra &output, U64 length) {
       auto end_of_read = length + stream.Pos();
       while (stream.Pos() < end_of_read) {
         auto header = stream.Read<ExtraHeader>();
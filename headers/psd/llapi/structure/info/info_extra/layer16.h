@@ -15,7 +15,7 @@ class Layer16 : public ExtraFor<Layer16> {
   }; // struct FromStreamFn
   struct ToStreamFn {
     void operator()(Stream &stream, const Layer16 &input) {
-      stream.Write(input.data, input.ContentLength());
+      stream.Write(input.data, false);
     }
   }; // struct ToStreamFn
   friend Stream;
@@ -16,7 +16,7 @@ class Layer32 : public ExtraFor<Layer32> {
   }; // struct FromStreamFn
   struct ToStreamFn {
     void operator()(Stream &stream, const Layer32 &input) {
-      stream.Write(input.data, input.ContentLength());
+      stream.Write(input.data, false);
     }
   }; // struct ToStreamFn
   friend Stream;
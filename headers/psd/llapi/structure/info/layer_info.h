@@ -2,6 +2,11 @@
 #pragma once
 
 #include "psd/llapi/structure/header.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <psd/llapi/executor.h>
 #include <psd/llapi/structure/info/layer_info/layer_data.h>
 #include <psd/llapi/structure/info/layer_info/channel_data.h>
 
@@ -13,10 +18,11 @@ struct LayerRecord {
 }; // class Layer
 class LayerInfo {
   struct FromStreamFn {
-    void operator()(Stream &stream, LayerInfo &output, unsigned length) {
+    void operator()(Stream &stream, LayerInfo &output, U64 length) {
       if (!length) return;
-      auto start       = stream.Pos();
-      auto layer_count = stream.Read<U16>();
+      auto start = stream.Pos();
+      // A negative count flags the first alpha channel as merged transparency.
+      auto layer_count = std::abs(stream.Read<I16>());
       output.record.resize(layer_count);
       for (auto &record : output.record) {
         stream.ReadTo(record.layer_data);
@@ -24,32 +30,34 @@ class LayerInfo {
       for (auto &record : output.record) {
         stream.ReadTo(record.channel_data, record.layer_data.channel_info);
       }
-      auto readed = stream.Pos() - start;
-      while (readed++ % 4) {
-        stream++;
-      }
-      // if ((stream.Pos() - start) % 2) stream++;
+      stream.SetPos(start + length);
     }
     void operator()(Stream &stream, LayerInfo &output) {
-      operator()(stream, output, stream.Read<U32>());
+      operator()(stream, output, stream.ReadLength());
     }
   }; // struct FromStreamFn
   struct ToStreamFn {
-    void operator()(Stream &stream, const LayerInfo &input, U32 length) {
-      stream.Write(length);
-      if (input.record.empty()) {
-        return;
-      }
-      stream.Write(U16(input.record.size()));
-      for (const auto &record : input.record) {
-        stream.Write(record.layer_data);
+    // Lr16 and Lr32 blocks embed the section without its length field.
+    void operator()(Stream &stream, const LayerInfo &input, bool prefixed) {
+      auto start = prefixed ? stream.ReserveLength() : stream.Pos();
+      if (!input.record.empty()) {
+        stream.Write(U16(input.record.size()));
+        for (const auto &record : input.record) {
+          stream.Write(record.layer_data);
+        }
+        for (const auto &record : input.record) {
+          stream.Write(record.channel_data);
+        }
+        while ((stream.Pos() - start) % 4) {
+          stream.Write(U8(0));
+        }
       }
-      for (const auto &record : input.record) {
-        stream.Write(record.channel_data);
+      if (prefixed) {
+        stream.PatchLength(start);
       }
     }
     void operator()(Stream &stream, const LayerInfo &input) {
-      operator()(stream, input, input.ContentLength());
+      operator()(stream, input, true);
     }
   }; // struct ToStreamFn
   friend Stream;
@@ -72,28 +80,129 @@ public:
       }
     }
   }
-  void Decompress(const Header &header) {
-    for (auto index = 0u;
-              index < record.size();
-              index++) {
-      record[index].channel_data.Decompress(header, record[index].layer_data);
-      UpdateChannelInfo();
+  // Every compressed channel of every record is an independent job, they
+  // are handed to `executor` largest first so the long ones do not end up
+  // trailing behind on a single thread.
+  void Decompress(const Header &header, Executor &executor = DefaultExecutor()) {
+    std::vector<std::pair<U64, Job>> pending;
+    for (auto &record : record) {
+      const auto &coordinates = record.layer_data.coordinates;
+      auto row_count    = unsigned(coordinates.bottom - coordinates.top);
+      auto column_count = unsigned(coordinates.right  - coordinates.left);
+      for (auto &entry : record.channel_data.data) {
+        auto &channel = entry.second;
+        if (channel.compression == Compression::None) {
+          continue;
+        }
+        pending.emplace_back(U64(row_count) * column_count, [&header, &channel, row_count, column_count]() {
+          channel.data = llapi::Decompress(
+            channel.data,
+            row_count,
+            column_count,
+            header.depth,
+            channel.compression,
+            header.version
+          );
+          channel.compression = Compression::None;
+        });
+      }
     }
+    RunLargestFirst(pending, executor);
+    UpdateChannelInfo();
   }
-  void Compress(Compression compression, unsigned level, const Header &header) {
-    for (auto index = 0u;
-              index < record.size();
-              index++) {
-      const auto &coordinates = record[index].layer_data.coordinates;
-      record[index].channel_data.Compress(
-        compression,
-        level,
-        coordinates.bottom - coordinates.top,
-        coordinates.right  - coordinates.left,
-        header.depth
-      );
+  // Same scheduling as Decompress. Each job only touches its own channel,
+  // so the bytes written do not depend on the executor. Large deflate
+  // channels are split into chunks that go into the same batch as the rest,
+  // no job runs a batch of its own. Adaptive codecs are picked in a batch
+  // before, the split depends on them.
+  void Compress(
+    Compression                          compression,
+    unsigned                             level,
+    const Header                        &header,
+    Executor                            &executor = DefaultExecutor(),
+    const std::optional<AdaptiveBudget> &adaptive = std::nullopt
+  ) {
+    if (compression == Compression::None && !adaptive) {
       UpdateChannelInfo();
+      return;
+    }
+    struct Target {
+      Channel                       *channel;
+      unsigned                       row_count;
+      unsigned                       column_count;
+      Compression                    chosen;
+      std::unique_ptr<DeflateChunks> chunks;
+    }; // struct Target
+    std::vector<Target> targets;
+    for (auto &record : record) {
+      const auto &coordinates = record.layer_data.coordinates;
+      auto row_count    = unsigned(coordinates.bottom - coordinates.top);
+      auto column_count = unsigned(coordinates.right  - coordinates.left);
+      for (auto &entry : record.channel_data.data) {
+        // Already compressed, e.g. passed through from the opened file.
+        if (entry.second.compression == Compression::None) {
+          targets.push_back({&entry.second, row_count, column_count, compression, nullptr});
+        }
+      }
+    }
+    std::vector<std::pair<U64, Job>> pending;
+    if (adaptive) {
+      for (auto &target : targets) {
+        pending.emplace_back(target.channel->data.size(), [&]() {
+          target.chosen = ChooseCompression(
+            target.channel->data,
+            target.row_count,
+            target.column_count,
+            header.depth,
+            level,
+            header.version,
+            *adaptive
+          );
+        });
+      }
+      RunLargestFirst(pending, executor);
+      pending.clear();
+    }
+    for (auto &target : targets) {
+      const auto length = target.channel->data.size();
+      if ((target.chosen == Compression::Deflate ||
+           target.chosen == Compression::DeflateDelta) && DeflateChunks::Splits(length)) {
+        target.chunks = std::make_unique<DeflateChunks>(
+          target.channel->data,
+          target.row_count,
+          target.column_count,
+          header.depth,
+          target.chosen,
+          level
+        );
+        for (auto index = std::size_t(0); index < target.chunks->Count(); index++) {
+          pending.emplace_back(std::min(DeflateChunkLength, length - index * DeflateChunkLength), [&target, index]() {
+            target.chunks->Compress(index);
+          });
+        }
+        continue;
+      }
+      pending.emplace_back(length, [&]() {
+        target.channel->data = llapi::Compress(
+          target.channel->data,
+          target.row_count,
+          target.column_count,
+          header.depth,
+          target.chosen,
+          level,
+          header.version
+        );
+        target.channel->compression = target.chosen;
+      });
+    }
+    RunLargestFirst(pending, executor);
+    for (auto &target : targets) {
+      if (target.chunks) {
+        target.channel->data        = target.chunks->Join();
+        target.channel->compression = target.chosen;
+      }
     }
+    UpdateChannelInfo();
   }
 private:
   U32 ContentLength() const {
@@ -2,10 +2,13 @@
 #pragma once
 
 #include "psd/error.h"
+#include "psd/llapi/executor.h"
 #include "psd/llapi/structure/header.h"
 #include "psd/llapi/structure/info/layer_info/layer_data.h"
 #include <cassert>
 #include <map>
+#include <memory>
+#include <optional>
 #include <psd/llapi/stream.h>
 #include <psd/export.h>
 #include <type_traits>
@@ -43,79 +46,158 @@ constexpr unsigned ByteCount(Depth depth) {
 }
 PSD_EXPORT std::vector<U8>
 DecompressDefault(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version version = Version::PSD
 );
 PSD_EXPORT std::vector<U8>
 DecompressDeflate(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version version = Version::PSD
 );
 PSD_EXPORT std::vector<U8>
 DecompressDeflateDelta(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version version = Version::PSD
 );
 inline std::vector<U8> Decompress(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
   Depth depth,
-  Compression compression
+  Compression compression,
+  Version version = Version::PSD
 ) {
   auto decompress = [&](auto function){
     return function(
       input,
       row_count,
       column_count,
-      depth
+      depth,
+      version
     );
   };
   switch (compression) {
-    case Compression::None         : return input;
+    case Compression::None         : return std::vector<U8>(input.begin(), input.end());
     case Compression::Default      : return decompress(DecompressDefault);
     case Compression::Deflate      : return decompress(DecompressDeflate);
     case Compression::DeflateDelta : return decompress(DecompressDeflateDelta);
     default: throw Error("err");
   }
 }
+// Decodes a channel straight into 8-bit samples placed `stride` bytes apart,
+// row by row through RowDecoder, e.g. one component of an interleaved
+// image. No depth converted copy of the channel is made.
+PSD_EXPORT void
+DecodeChannelTo(
+  ByteView    input,
+  Compression compression,
+  unsigned    row_count,
+  unsigned    column_count,
+  Depth       depth,
+  Version     version,
+  U8         *output,
+  std::size_t stride
+);
+class RowDecoder;
+
+// Reads the next `row_count` rows of `input`, keeps every `factor`-th one
+// and averages each `factor` adjacent columns of it into one sample, for
+// ceil(row_count / factor) rows of ceil(column_count / factor) samples.
+PSD_EXPORT void
+DecodeChannelTo(
+  RowDecoder &input,
+  unsigned    row_count,
+  unsigned    factor,
+  U8         *output,
+  std::size_t stride
+);
 PSD_EXPORT std::vector<U8>
 CompressDefault(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
   Depth depth,
-  unsigned level
+  unsigned level,
+  Version version = Version::PSD
 );
+// Inputs of at least two chunks are split into chunks of this length when
+// an executor is given. Each chunk is deflated on its own, pigz style,
+// primed with the 32 KiB before it and ended by a sync flush, and the
+// results are joined into a single zlib stream any inflater reads.
+inline constexpr std::size_t DeflateChunkLength = std::size_t(1) << 20;
+
+// Chunked deflate of one channel handed out as jobs, for callers that
+// schedule many channels in one batch and would otherwise have to run a
+// nested one per large channel. Once Compress has run for every chunk,
+// Join returns the same bytes CompressDeflate writes with an executor.
+class PSD_EXPORT DeflateChunks {
+public:
+  // Whether CompressDeflate splits an input of `length` bytes.
+  static bool Splits(std::size_t length) {
+    return length >= 2 * DeflateChunkLength;
+  }
+  // Deflate or DeflateDelta, the delta filter is applied to a copy here.
+  // The copy is owned, plain Deflate input has to outlive the chunks.
+  DeflateChunks(
+    ByteView    input,
+    unsigned    row_count,
+    unsigned    column_count,
+    Depth       depth,
+    Compression compression,
+    unsigned    level
+  );
+  std::size_t Count() const {
+    return chunks_.size();
+  }
+  // Deflates chunk `index`, different chunks may run at the same time.
+  void Compress(std::size_t index);
+  std::vector<U8> Join() const;
+private:
+  std::vector<U8>              encoded_;
+  ByteView                     input_;
+  unsigned                     level_;
+  std::vector<std::vector<U8>> chunks_;
+  std::vector<U32>             sums_;
+}; // class DeflateChunks
+
 PSD_EXPORT std::vector<U8>
 CompressDeflate(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
   Depth depth,
-  unsigned level
+  unsigned level,
+  Version version = Version::PSD,
+  Executor *executor = nullptr
 );
 PSD_EXPORT std::vector<U8>
 CompressDeflateDelta(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
   Depth depth,
-  unsigned level
+  unsigned level,
+  Version version = Version::PSD,
+  Executor *executor = nullptr
 );
 inline std::vector<U8> Compress(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
   Depth depth,
   Compression compression,
-  unsigned level
+  unsigned level,
+  Version version = Version::PSD,
+  Executor *executor = nullptr
 ) {
   auto compress = [&](auto function){
     return function(
@@ -123,20 +205,45 @@ inline std::vector<U8> Compress(
       row_count,
       column_count,
       depth,
-      level
+      level,
+      version,
+      executor
     );
   };
   switch (compression) {
-    case Compression::None         : return input;
-    case Compression::Default      : return compress(CompressDefault);
+    case Compression::None         : return std::vector<U8>(input.begin(), input.end());
+    case Compression::Default      : return CompressDefault(input, row_count, column_count, depth, level, version);
     case Compression::Deflate      : return compress(CompressDeflate);
     case Compression::DeflateDelta : return compress(CompressDeflateDelta);
     default: throw Error("err");
   }
 }
+// Limits how hard an adaptive save works for a smaller file. Passed to the
+// Compress functions in place of a fixed codec, each channel is then stored
+// with whichever one ChooseCompression picks for it.
+struct AdaptiveBudget {
+  // Rows trial-compressed per channel, spread evenly over its height. Zero
+  // trials whole channels.
+  unsigned sample_rows = 16;
+  // Fraction of the size a costlier codec has to save over the best cheaper
+  // one before it is picked.
+  F32 min_saving = 0.1f;
+  // Costliest codec tried, in order None, Default, Deflate, DeflateDelta.
+  Compression ceiling = Compression::DeflateDelta;
+}; // struct AdaptiveBudget
+PSD_EXPORT Compression
+ChooseCompression(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count,
+  Depth depth,
+  unsigned level,
+  Version version = Version::PSD,
+  const AdaptiveBudget &budget = AdaptiveBudget()
+);
 class Channel {
   struct FromStreamFn {
-    void operator()(Stream &stream, Channel &output, unsigned length) {
+    void operator()(Stream &stream, Channel &output, U64 length) {
       stream.ReadTo(output.compression);
       stream.ReadTo(output.data, length - 2);
     }
@@ -153,6 +260,7 @@ class Channel {
   }
 public:
   Channel() = default;
+  Channel(Bytes data) : data(std::move(data)) {}
   Channel(std::vector<U8> data) : data(std::move(data)) {}
 
   bool operator==(const Channel &other) const {
@@ -162,12 +270,88 @@ public:
     return !operator==(other);
   }
   Compression compression = Compression::None;
-  std::vector<U8> data;
+  Bytes       data;
 }; // class Channel
 
+// Decodes a channel one row at a time, so large layers can be streamed
+// through a single row of memory. Raw and RLE rows are read in place from
+// the input, which has to outlive the decoder. zlib channels that inflate
+// to at most `inflate_limit` bytes are inflated whole by libdeflate, which
+// is faster, larger ones are stream-inflated a row at a time. Samples come
+// out in native byte order.
+class PSD_EXPORT RowDecoder {
+public:
+  static constexpr std::size_t InflateLimit = std::size_t(1) << 24;
+
+  RowDecoder(
+    ByteView    input,
+    Compression compression,
+    unsigned    row_count,
+    unsigned    column_count,
+    Depth       depth,
+    Version     version       = Version::PSD,
+    std::size_t inflate_limit = InflateLimit
+  );
+  RowDecoder(
+    const Channel &input,
+    unsigned       row_count,
+    unsigned       column_count,
+    Depth          depth,
+    Version        version       = Version::PSD,
+    std::size_t    inflate_limit = InflateLimit
+  ) : RowDecoder(input.data, input.compression, row_count, column_count, depth, version, inflate_limit) {}
+  ~RowDecoder();
+  RowDecoder(RowDecoder &&) noexcept;
+  RowDecoder &operator=(RowDecoder &&) noexcept;
+
+  // Decodes the next row, the view stays valid until the following call.
+  ByteView Next();
+  // Steps over rows without decoding them, RLE rows only cost a look at
+  // the byte count table.
+  void Skip(unsigned count);
+
+  bool Done() const {
+    return row_ == row_count_;
+  }
+  unsigned Row() const {
+    return row_;
+  }
+  unsigned RowCount() const {
+    return row_count_;
+  }
+  unsigned ColumnCount() const {
+    return column_count_;
+  }
+  Depth SampleDepth() const {
+    return depth_;
+  }
+  std::size_t RowLength() const {
+    return row_length_;
+  }
+private:
+  ByteView        input_;
+  Compression     compression_;
+  unsigned        row_count_;
+  unsigned        column_count_;
+  Depth           depth_;
+  std::size_t     count_width_;
+  std::size_t     row_length_;
+  unsigned        row_      = 0;
+  std::size_t     position_ = 0;
+  std::vector<U8> row_buffer_;
+  std::vector<U8> inflated_;
+
+  // zlib stream state, only set while a channel is stream-inflated. The
+  // row is then inflated into `inflated_`, which holds just that one row.
+  struct Inflater;
+  std::unique_ptr<Inflater> inflater_;
+
+  U8 *InflatedRow();
+}; // class RowDecoder
+
 class ChannelData {
   struct FromStreamFn {
-    void operator()(Stream &stream, ChannelData &output, const std::map<I16, U32> &channel_info) {
+    void operator()(Stream &stream, ChannelData &output, const std::map<I16, U64> &channel_info) {
       for (auto [index, length] : channel_info) {
         stream.ReadTo(output.data[index], length);
       }
@@ -209,17 +393,28 @@ public:
     auto column_count = coordinates.right  - coordinates.left;
     for (auto &[channel, pair] : data) {
       auto &[compression, data] = pair;
+      if (compression == Compression::None) {
+        continue;
+      }
       data = llapi::Decompress(
         data,
         row_count,
         column_count,
         header.depth,
-        compression
+        compression,
+        header.version
       );
       compression = Compression::None;
     }
   }
-  void Compress(Compression compr, unsigned level, unsigned row_count, unsigned column_count, Depth depth) {
+  void Compress(
+    Compression compr,
+    unsigned    level,
+    unsigned    row_count,
+    unsigned    column_count,
+    Depth       depth,
+    Version     version = Version::PSD
+  ) {
     for (auto &[channel, pair] : data) {
       auto &[compression, data] = pair;
       if (compr == Compression::None) {
@@ -231,12 +426,23 @@ public:
         column_count,
         depth,
         compr,
-        level
+        level,
+        version
       );
       compression = compr;
     }
   }
 }; // class ChannelData
+// Depth conversion of native samples. Integers scale by the ratio of the
+// maxima and round to nearest, 16 to 8 bit as (x * 255 + 32767) / 65535.
+// Floats are clamped to [0, 1] first.
+PSD_EXPORT void ConvertSamples(const U8  *input, U16 *output, std::size_t count);
+PSD_EXPORT void ConvertSamples(const U8  *input, F32 *output, std::size_t count);
+PSD_EXPORT void ConvertSamples(const U16 *input, U8  *output, std::size_t count);
+PSD_EXPORT void ConvertSamples(const U16 *input, F32 *output, std::size_t count);
+PSD_EXPORT void ConvertSamples(const F32 *input, U8  *output, std::size_t count);
+PSD_EXPORT void ConvertSamples(const F32 *input, U16 *output, std::size_t count);
+
 namespace detail {
 class ConvertChannelDataColorFn {
 public:
@@ -255,16 +461,17 @@ private:
   }
   ChannelData ToGrayscale(ChannelData input) {
     ChannelData output;
+    std::vector<U8> gray(LengthOf(input));
     for (auto index = 0u;
               index < LengthOf(input);
               index++)
     {
-      output.data[0].data.push_back(
+      gray[index] =
         0.299 * input.data.at(0).data[index] +
         0.587 * input.data.at(1).data[index] +
-        0.114 * input.data.at(2).data[index]
-      );
+        0.114 * input.data.at(2).data[index];
     }
+    output.data[0] = std::move(gray);
     if (input.data.find(-1) != input.data.end()) {
       output.data[-1] = std::move(input.data.at(-1));
     } else {
@@ -309,89 +516,39 @@ private:
 class ConvertDepthFn {
 public:
   std::vector<U8> operator()(std::vector<U8> input, Depth input_depth, Depth output_depth) const {
+    if (input_depth == output_depth) {
+      return input;
+    }
     if (input_depth == Depth::Eight && output_depth == Depth::Sixteen) {
-      return Convert816(std::move(input));
+      return Convert<U8, U16>(input);
     }
     if (input_depth == Depth::Eight && output_depth == Depth::ThirtyTwo) {
-      return Convert832(std::move(input));
+      return Convert<U8, F32>(input);
     }
     if (input_depth == Depth::Sixteen && output_depth == Depth::Eight) {
-      return Convert168(std::move(input));
+      return Convert<U16, U8>(input);
     }
     if (input_depth == Depth::Sixteen && output_depth == Depth::ThirtyTwo) {
-      return Convert1632(std::move(input));
+      return Convert<U16, F32>(input);
     }
     if (input_depth == Depth::ThirtyTwo && output_depth == Depth::Eight) {
-      return Convert328(std::move(input));
+      return Convert<F32, U8>(input);
     }
     if (input_depth == Depth::ThirtyTwo && output_depth == Depth::Sixteen) {
-      return Convert3216(std::move(input));
+      return Convert<F32, U16>(input);
     }
     throw Error("UnsupportedDepthcvt");
   }
 private:
-  template <typename T>
-  std::vector<T> &Represent(std::vector<U8> &input) const {
-    return reinterpret_cast<std::vector<T> &>(input);
-  }
-  std::vector<U8> Convert832(std::vector<U8> input) const {
-    std::vector<U8> output(input.size() * sizeof(F32));
-    for (auto index = 0u;
-              index < input.size();
-              index++) {
-      Represent<F32>(output)[index] = F32(input[index]) / 0xff;
-    }
-    return output;
-  }
-  std::vector<U8> Convert816(std::vector<U8> input) const {
-    std::vector<U8> output(input.size() * sizeof(U16));
-    for (auto index = 0u;
-              index < input.size();
-              index++) {
-      Represent<U16>(output)[index] = U16(input[index]) * (0xffff / 0xff);
-    }
-    return output;
-  }
-  std::vector<U8> Convert168(std::vector<U8> input) const {
-    assert(input.size() % sizeof(U16) == 0);
-    std::vector<U8> output(input.size() / sizeof(U16));
-    for (auto index = 0u;
-              index < input.size() / sizeof(U16);
-              index++) {
-      output[index] = (Represent<U16>(input)[index] * 0xff) / 0xffff;
-    }
-    return output;
-  }
-  std::vector<U8> Convert1632(std::vector<U8> input) const {
-    assert(input.size() % sizeof(U16) == 0);
-    std::vector<U8> output((input.size() / sizeof(U16)) * sizeof(F32));
-    for (auto index = 0u;
-              index < input.size() / sizeof(U16);
-              index++) {
-      Represent<F32>(output)[index] = F32(Represent<U16>(input)[index]) / 0xffff;
-    }
-    return output;
-  }
-  std::vector<U8> Convert328(std::vector<U8> input) const {
-    assert(input.size() % sizeof(F32) == 0);
-    std::vector<U8> output(input.size() / sizeof(F32));
-    for (auto index = 0u;
-              index < input.size() / sizeof(F32);
-              index++) {
-      output[index] =
-        std::min(std::max(Represent<F32>(input)[index], 0.0f), 1.0f) * 255.0f + 0.5f;
-    }
-    return output;
-  }
-  std::vector<U8> Convert3216(std::vector<U8> input) const {
-    assert(input.size() % sizeof(F32) == 0);
-    std::vector<U8> output((input.size() / sizeof(F32)) * sizeof(U16));
-    for (auto index = 0u;
-              index < input.size() / sizeof(F32);
-              index++) {
-      Represent<U16>(output)[index] =
-        std::min(std::max(Represent<F32>(input)[index], 0.0f), 1.0f) * 65535.0f + 0.5f;
-    }
+  template <typename I, typename O>
+  std::vector<U8> Convert(const std::vector<U8> &input) const {
+    assert(input.size() % sizeof(I) == 0);
+    std::vector<U8> output(input.size() / sizeof(I) * sizeof(O));
+    ConvertSamples(
+      reinterpret_cast<const I *>(input.data()),
+      reinterpret_cast<O *>(output.data()),
+      input.size() / sizeof(I)
+    );
     return output;
   }
 };
@@ -413,7 +570,7 @@ public:
       output.data[index] = ConvertDepth(
         std::move(
           input.data[index].data
-        ),
+        ).Release(),
         input_depth,
         output_depth
       );
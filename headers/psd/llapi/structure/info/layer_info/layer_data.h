@@ -31,10 +31,10 @@ class Coordinates {
   }; // struct ToStreamFn
   friend Stream;
 public:
-  U32 top;
-  U32 left;
-  U32 bottom;
-  U32 right;
+  U32 top    = 0;
+  U32 left   = 0;
+  U32 bottom = 0;
+  U32 right  = 0;
 }; // class Coordinates
 class LayerFlags {
   struct FromStreamFn {
@@ -132,7 +132,7 @@ class LayerData {
     void ReadChannelInfo(Stream &stream, LayerData &output) {
       for (auto index = 0u; index < output.channel_count; index++) {
         auto channel = stream.Read<I16>();
-        auto length  = stream.Read<U32>();
+        auto length  = stream.ReadLength();
         output.channel_info[channel] = length;
       }
     }
@@ -200,7 +200,10 @@ class LayerData {
       stream.Write(input.channel_count);
     }
     void WriteChannelInfo(Stream &stream, const LayerData &input) {
-      stream.Write(input.channel_info);
+      for (const auto &[channel, length] : input.channel_info) {
+        stream.Write(channel);
+        stream.WriteLength(length);
+      }
     }
     void WriteBlendingSignature(Stream &stream) {
       stream.Write(U32(0x3842494D));
@@ -218,9 +221,6 @@ class LayerData {
       stream.Write(input.flags);
       stream.Write(U8(0));
     }
-    void WriteExtraLength(Stream &stream, const LayerData &input) {
-      stream.Write(U32(input.ExtraLength()));
-    }
     void WriteAdjustmentInfo(Stream &stream, const LayerData &input) {
       stream.Write(input.adjustment_info);
     }
@@ -248,11 +248,12 @@ class LayerData {
       WriteOpacity           (stream, input);
       WriteClipping          (stream, input);
       WriteFlags             (stream, input);
-      WriteExtraLength       (stream, input);
+      auto start = stream.ReserveLength(false);
       WriteAdjustmentInfo    (stream, input);
       WriteBlendingInfo      (stream, input);
       WriteName              (stream, input);
       WriteExtra             (stream, input);
+      stream.PatchLength(start, false);
     }
   }; // struct ToStreamFn
   friend Stream;
@@ -261,7 +262,7 @@ public:
 
   Coordinates        coordinates;
   U16                channel_count;
-  std::map<I16, U32> channel_info;
+  std::map<I16, U64> channel_info;
   Blending           blending;
   U8                 opacity;
   U8                 clipping;
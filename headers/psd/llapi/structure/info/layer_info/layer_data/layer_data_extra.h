@@ -11,7 +11,7 @@ namespace PSD::llapi {
 
 class LayerDataExtra {
   struct FromStreamFn {
-    void operator()(Stream &stream, LayerDataExtra &output, unsigned length) {
+    void operator()(Stream &stream, LayerDataExtra &output, U64 length) {
       auto end_of_read = length + stream.Pos();
       while (stream.Pos() < end_of_read) {
         auto header = stream.Read<ExtraHeader>();
@@ -55,7 +55,7 @@ struct FromStreamFn<std::shared_ptr<Extra>> {
     while (length++ % 4) stream++;
     output = extra;
   }
-  void operator()(Stream &stream, std::shared_ptr<Extra> &output, std::shared_ptr<Extra> extra, unsigned start) {
+  void operator()(Stream &stream, std::shared_ptr<Extra> &output, std::shared_ptr<Extra> extra, U64 start) {
     auto length = stream.Pos() - start;
     while (length++ % 4) stream++;
     output = extra;
@@ -74,14 +74,14 @@ class ExtraHeader {
       if (signature != 0x3842494D &&
           signature != 0x38423634) throw Error("PSD::Error: ExtraHeaderSignatureError");
       stream.ReadTo(output.id);
-      stream.ReadTo(output.content_length);
+      output.content_length = stream.ReadLength(output.Large(stream));
     }
   }; // struct FromStreamFn;
   struct ToStreamFn {
     void operator()(Stream &stream, const ExtraHeader &input) {
       stream.Write(U32(0x3842494D));
       stream.Write(input.id);
-      stream.Write(input.content_length);
+      stream.WriteLength(input.content_length, input.Large(stream));
     }
   }; // struct ToStreamFn
   friend Stream;
@@ -96,10 +96,34 @@ public:
   bool operator!=(const ExtraHeader &other) const {
     return !operator==(other);
   }
-  ExtraID id; U32 content_length;
+  ExtraID id; U64 content_length;
   constexpr U32 Length() const {
     return 12;
   }
+  // Blocks that may carry pixel data have 8 byte lengths in PSB documents.
+  bool Large(const Stream &stream) const {
+    if (!stream.Large()) {
+      return false;
+    }
+    switch (static_cast<U32>(id)) {
+      case 0x4C4D736B: // LMsk
+      case 0x4C723136: // Lr16
+      case 0x4C723332: // Lr32
+      case 0x4C617972: // Layr
+      case 0x4D743136: // Mt16
+      case 0x4D743332: // Mt32
+      case 0x4D74726E: // Mtrn
+      case 0x416C7068: // Alph
+      case 0x464D736B: // FMsk
+      case 0x6C6E6B32: // lnk2
+      case 0x46456964: // FEid
+      case 0x46584964: // FXid
+      case 0x50785344: // PxSD
+        return true;
+      default:
+        return false;
+    }
+  }
 }; // class ExtraHeader
 namespace detail {
 //
@@ -132,10 +156,12 @@ public:
   }
 protected:
   void ToStream(Stream &stream) const override final {
-    stream.Write(ExtraHeader{ExtraToID<T>, ContentLength()});
+    auto header = ExtraHeader{ExtraToID<T>, 0};
+    stream.Write(header);
+    auto start = stream.Pos();
     stream.Write(Self());
-    auto length = ContentLength();
-    while (length++ % 4) {
+    stream.PatchLength(start, header.Large(stream));
+    while ((stream.Pos() - start) % 4) {
       stream.Write(U8(0));
     }
   }
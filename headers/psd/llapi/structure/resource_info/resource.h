@@ -61,10 +61,9 @@ class ResourceHeader {
         throw Error("PSD::Error: ResourceHeaderSignatureError");
       }
       stream.ReadTo(header.id);
+      // Pascal string name, padded to an even size with its length byte.
       auto length = stream.Read<U8>();
-      stream += length
-        ? length + 0
-        : length + 1;
+      stream += length + (length + 1) % 2;
       stream.ReadTo(header.content_length);
     }
   }; // struct FromStreamFn
@@ -0,0 +1,153 @@
+#include <psd/llapi/executor.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace PSD::llapi {
+//
+struct ThreadExecutor::Pool {
+  std::mutex               mutex;
+  std::condition_variable  wake;
+  std::condition_variable  idle;
+  std::vector<std::thread> threads;
+
+  // Current batch, guarded by `mutex` except for `next`. Workers join a
+  // batch once per generation and are counted in `active` while in it.
+  std::vector<Job>        *jobs       = nullptr;
+  std::size_t              generation = 0;
+  unsigned                 active     = 0;
+  bool                     stop       = false;
+  std::atomic<std::size_t> next{0};
+  std::exception_ptr       error;
+
+  // Held by Run for a whole batch.
+  std::mutex run;
+
+  void Work(std::vector<Job> &input);
+  void Serve();
+}; // struct ThreadExecutor::Pool
+
+namespace {
+//
+// Pool whose jobs the current thread is running, nested batches see it and
+// run inline instead of waiting for workers that are all busy.
+thread_local const void *current = nullptr;
+
+class CurrentScope {
+public:
+  CurrentScope(const void *pool)
+    : previous_(std::exchange(current, pool)) {}
+  ~CurrentScope() {
+    current = previous_;
+  }
+private:
+  const void *previous_;
+}; // class CurrentScope
+}; // namespace
+
+void ThreadExecutor::Pool::Work(std::vector<Job> &input) {
+  CurrentScope scope(this);
+  for (auto index = next++; index < input.size(); index = next++) {
+    try {
+      input[index]();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      next = input.size();
+    }
+  }
+}
+void ThreadExecutor::Pool::Serve() {
+  auto seen = std::size_t(0);
+  for (;;) {
+    std::vector<Job> *input = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() {
+        return stop || seen != generation;
+      });
+      if (stop) {
+        return;
+      }
+      seen = generation;
+      if (!jobs) {
+        continue;
+      }
+      input = jobs;
+      active++;
+    }
+    Work(*input);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!--active) {
+      idle.notify_all();
+    }
+  }
+}
+
+ThreadExecutor::ThreadExecutor()
+  : ThreadExecutor(std::thread::hardware_concurrency()) {}
+
+ThreadExecutor::ThreadExecutor(unsigned thread_count)
+  : thread_count_(std::max(thread_count, 1u))
+  , pool_(std::make_unique<Pool>()) {
+  pool_->threads.reserve(thread_count_ - 1);
+  for (auto index = 1u; index < thread_count_; index++) {
+    pool_->threads.emplace_back([pool = pool_.get()]() {
+      pool->Serve();
+    });
+  }
+}
+ThreadExecutor::~ThreadExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(pool_->mutex);
+    pool_->stop = true;
+  }
+  pool_->wake.notify_all();
+  for (auto &thread : pool_->threads) {
+    thread.join();
+  }
+}
+void ThreadExecutor::Run(std::vector<Job> &jobs) {
+  auto &pool = *pool_;
+  if (thread_count_ == 1 || jobs.size() <= 1 || current == &pool) {
+    CurrentScope scope(&pool);
+    for (auto &job : jobs) {
+      job();
+    }
+    return;
+  }
+  std::lock_guard<std::mutex> run(pool.run);
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.jobs  = &jobs;
+    pool.next  = 0;
+    pool.error = nullptr;
+    pool.generation++;
+  }
+  pool.wake.notify_all();
+  pool.Work(jobs);
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(pool.mutex);
+    pool.idle.wait(lock, [&]() {
+      return !pool.active;
+    });
+    pool.jobs = nullptr;
+    error = std::exchange(pool.error, nullptr);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+Executor &DefaultExecutor() {
+  static ThreadExecutor executor;
+  return executor;
+}
+}; // namespace PSD::llapi
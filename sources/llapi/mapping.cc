@@ -0,0 +1,107 @@
+#include <psd/llapi/mapping.h>
+#include <psd/error.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PSD::llapi {
+//
+#ifdef _WIN32
+Mapping::Mapping(const std::filesystem::path &path, Advice) {
+  file_ = CreateFileW(
+    path.c_str(),
+    GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_DELETE,
+    nullptr,
+    OPEN_EXISTING,
+    FILE_ATTRIBUTE_NORMAL,
+    nullptr
+  );
+  if (file_ == INVALID_HANDLE_VALUE) {
+    file_ = nullptr;
+    throw Error("PSD::Error: MappingError");
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size)) {
+    CloseHandle(file_);
+    throw Error("PSD::Error: MappingError");
+  }
+  length_ = static_cast<std::size_t>(size.QuadPart);
+  if (!length_) {
+    return;
+  }
+  handle_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!handle_) {
+    CloseHandle(file_);
+    throw Error("PSD::Error: MappingError");
+  }
+  data_ = static_cast<const std::uint8_t *>(
+    MapViewOfFile(handle_, FILE_MAP_READ, 0, 0, 0)
+  );
+  if (!data_) {
+    CloseHandle(handle_);
+    CloseHandle(file_);
+    throw Error("PSD::Error: MappingError");
+  }
+}
+Mapping::~Mapping() {
+  if (data_)   UnmapViewOfFile(data_);
+  if (handle_) CloseHandle(handle_);
+  if (file_)   CloseHandle(file_);
+}
+void Mapping::Advise(Advice, std::size_t, std::size_t) const {}
+#else
+Mapping::Mapping(const std::filesystem::path &path, Advice advice) {
+  auto descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (descriptor < 0) {
+    throw Error("PSD::Error: MappingError");
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) != 0) {
+    close(descriptor);
+    throw Error("PSD::Error: MappingError");
+  }
+  length_ = static_cast<std::size_t>(status.st_size);
+  if (!length_) {
+    close(descriptor);
+    return;
+  }
+  auto address = mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, descriptor, 0);
+  close(descriptor);
+  if (address == MAP_FAILED) {
+    throw Error("PSD::Error: MappingError");
+  }
+  data_ = static_cast<const std::uint8_t *>(address);
+  Advise(advice, 0, length_);
+}
+Mapping::~Mapping() {
+  if (data_) {
+    munmap(const_cast<std::uint8_t *>(data_), length_);
+  }
+}
+void Mapping::Advise(Advice advice, std::size_t offset, std::size_t length) const {
+  if (!data_ || offset >= length_) {
+    return;
+  }
+  // madvise wants a page aligned address, so widen the range downwards.
+  static const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  auto begin = offset - offset % page;
+  auto end   = std::min(offset + length, length_);
+  madvise(
+    const_cast<std::uint8_t *>(data_) + begin,
+    end - begin,
+    advice == Advice::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM
+  );
+}
+#endif
+}; // namespace PSD::llapi
@@ -0,0 +1,229 @@
+#include <psd/llapi/sink.h>
+#include <psd/error.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace PSD::llapi {
+//
+namespace {
+//
+// Hidden sibling of `path`, unique within the process through `attempt`
+// and across processes through the process id.
+std::filesystem::path TemporaryFor(const std::filesystem::path &path, unsigned long process, unsigned attempt) {
+  static std::atomic<unsigned> counter(0);
+  auto name = "." + path.filename().string()
+            + "." + std::to_string(process)
+            + "." + std::to_string(counter++ + attempt)
+            + ".tmp";
+  return path.parent_path() / name;
+}
+constexpr unsigned AttemptCount = 16;
+// File a save to `path` lands in. Symbolic links are followed so the
+// rename replaces what they point to and they stay links.
+std::filesystem::path TargetOf(const std::filesystem::path &path) {
+  auto output = path;
+  std::error_code error;
+  for (auto hop = 0u; hop < 40 && std::filesystem::is_symlink(output, error); hop++) {
+    auto link = std::filesystem::read_symlink(output, error);
+    if (error) {
+      break;
+    }
+    output = link.is_absolute() ? link : output.parent_path() / link;
+  }
+  return output;
+}
+}; // namespace
+#ifdef _WIN32
+namespace {
+//
+void WriteAll(void *file, std::uint64_t offset, const std::uint8_t *data, std::size_t length) {
+  while (length) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset     = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    auto chunk = static_cast<DWORD>(std::min<std::size_t>(length, 1u << 30));
+    if (!WriteFile(file, data, chunk, &written, &overlapped) || !written) {
+      throw Error("PSD::Error: SinkError");
+    }
+    offset += written;
+    data   += written;
+    length -= written;
+  }
+}
+// Renames `file` over `path` through its handle. With POSIX semantics the
+// old file may still be open, or mapped by a document opened lazily, as
+// long as its handle shares delete access, which Mapping grants.
+// SDKs older than Windows 10 1607 have no such rename.
+bool RenameOver(void *file, const std::filesystem::path &path) {
+#ifndef FILE_RENAME_FLAG_POSIX_SEMANTICS
+  return false;
+#else
+  auto name = std::filesystem::absolute(path).native();
+  std::vector<std::uint8_t> buffer(sizeof(FILE_RENAME_INFO) + name.size() * sizeof(wchar_t));
+  auto info = reinterpret_cast<FILE_RENAME_INFO *>(buffer.data());
+  info->Flags          = FILE_RENAME_FLAG_REPLACE_IF_EXISTS | FILE_RENAME_FLAG_POSIX_SEMANTICS;
+  info->RootDirectory  = nullptr;
+  info->FileNameLength = static_cast<DWORD>(name.size() * sizeof(wchar_t));
+  std::memcpy(info->FileName, name.c_str(), info->FileNameLength);
+  return SetFileInformationByHandle(file, FileRenameInfoEx, info, static_cast<DWORD>(buffer.size()));
+#endif
+}
+}; // namespace
+Sink::Sink(const std::filesystem::path &path) : path_(TargetOf(path)) {
+  for (auto attempt = 0u; attempt < AttemptCount && !file_; attempt++) {
+    temporary_ = TemporaryFor(path_, GetCurrentProcessId(), attempt);
+    file_ = CreateFileW(
+      temporary_.c_str(),
+      GENERIC_WRITE | DELETE,
+      0,
+      nullptr,
+      CREATE_NEW,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr
+    );
+    if (file_ == INVALID_HANDLE_VALUE) {
+      file_ = nullptr;
+      if (GetLastError() != ERROR_FILE_EXISTS) {
+        break;
+      }
+    }
+  }
+  if (!file_) {
+    throw Error("PSD::Error: SinkError");
+  }
+}
+Sink::~Sink() {
+  if (file_) {
+    CloseHandle(file_);
+    DeleteFileW(temporary_.c_str());
+  }
+}
+void Sink::Commit() {
+  if (!file_) {
+    throw Error("PSD::Error: SinkError");
+  }
+  auto flushed = FlushFileBuffers(file_);
+  auto renamed = flushed && RenameOver(file_, path_);
+  CloseHandle(file_);
+  file_ = nullptr;
+  // File systems without POSIX renames, FAT and older Windows, fall back to
+  // a plain move, which fails while the old file is in use.
+  if (flushed && !renamed) {
+    renamed = MoveFileExW(
+      temporary_.c_str(),
+      path_.c_str(),
+      MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH
+    );
+  }
+  if (!renamed) {
+    auto error = GetLastError();
+    DeleteFileW(temporary_.c_str());
+    if (error == ERROR_SHARING_VIOLATION || error == ERROR_ACCESS_DENIED || error == ERROR_USER_MAPPED_FILE) {
+      throw Error("PSD::Error: TargetInUse");
+    }
+    throw Error("PSD::Error: SinkError");
+  }
+}
+void Sink::Append(const std::uint8_t *data, std::size_t length) {
+  WriteAll(file_, length_, data, length);
+  length_ += length;
+}
+void Sink::WriteAt(std::uint64_t offset, const std::uint8_t *data, std::size_t length) {
+  if (offset + length > length_) {
+    throw Error("PSD::Error: SinkError");
+  }
+  WriteAll(file_, offset, data, length);
+}
+#else
+Sink::Sink(const std::filesystem::path &path) : path_(TargetOf(path)) {
+  for (auto attempt = 0u; attempt < AttemptCount && descriptor_ < 0; attempt++) {
+    temporary_  = TemporaryFor(path_, static_cast<unsigned long>(getpid()), attempt);
+    descriptor_ = open(temporary_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (descriptor_ < 0 && errno != EEXIST) {
+      break;
+    }
+  }
+  if (descriptor_ < 0) {
+    throw Error("PSD::Error: SinkError");
+  }
+  // A file being replaced hands its owner and mode on to the new one. Only
+  // root may give a file away, others stay its owner.
+  struct stat status;
+  if (stat(path_.c_str(), &status) == 0) {
+    if ((fchown(descriptor_, status.st_uid, status.st_gid) != 0 && errno != EPERM) ||
+         fchmod(descriptor_, status.st_mode & 07777) != 0) {
+      close(descriptor_);
+      descriptor_ = -1;
+      unlink(temporary_.c_str());
+      throw Error("PSD::Error: SinkError");
+    }
+  }
+}
+Sink::~Sink() {
+  if (descriptor_ >= 0) {
+    close(descriptor_);
+    unlink(temporary_.c_str());
+  }
+}
+void Sink::Commit() {
+  if (descriptor_ < 0) {
+    throw Error("PSD::Error: SinkError");
+  }
+  auto synced = fsync(descriptor_) == 0;
+  auto closed = close(descriptor_) == 0;
+  descriptor_ = -1;
+  if (!synced || !closed || std::rename(temporary_.c_str(), path_.c_str()) != 0) {
+    unlink(temporary_.c_str());
+    throw Error("PSD::Error: SinkError");
+  }
+}
+void Sink::Append(const std::uint8_t *data, std::size_t length) {
+  while (length) {
+    auto written = write(descriptor_, data, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      throw Error("PSD::Error: SinkError");
+    }
+    data    += written;
+    length  -= written;
+    length_ += written;
+  }
+}
+void Sink::WriteAt(std::uint64_t offset, const std::uint8_t *data, std::size_t length) {
+  if (offset + length > length_) {
+    throw Error("PSD::Error: SinkError");
+  }
+  while (length) {
+    auto written = pwrite(descriptor_, data, length, static_cast<off_t>(offset));
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      throw Error("PSD::Error: SinkError");
+    }
+    data   += written;
+    length -= written;
+    offset += written;
+  }
+}
+#endif
+}; // namespace PSD::llapi
@@ -0,0 +1,54 @@
+#include <psd/llapi/stream.h>
+#include <xsimd/xsimd.hpp>
+
+namespace PSD::llapi::detail {
+//
+namespace {
+//
+template <typename T, typename F>
+void SwapCopy(const void *input, void *output, std::size_t count, F swap) {
+  using Batch = xsimd::batch<T>;
+
+  auto source = static_cast<const U8 *>(input);
+  auto target = static_cast<U8 *>(output);
+  auto index  = std::size_t(0);
+  for (; index + Batch::size <= count;
+         index += Batch::size) {
+    auto value = Batch::load_unaligned(reinterpret_cast<const T *>(source + index * sizeof(T)));
+    swap(value).store_unaligned(reinterpret_cast<T *>(target + index * sizeof(T)));
+  }
+  // memcpy keeps the tail safe when input and output are the same range.
+  for (; index < count; index++) {
+    T value;
+    std::memcpy(&value, source + index * sizeof(T), sizeof(T));
+    value = ByteSwap(value);
+    std::memcpy(target + index * sizeof(T), &value, sizeof(T));
+  }
+}
+}; // namespace
+void ByteSwapCopy16(const void *input, void *output, std::size_t count) {
+  using Batch = xsimd::batch<U16>;
+  SwapCopy<U16>(input, output, count, [](Batch value) {
+    return (value << 8) | (value >> 8);
+  });
+}
+void ByteSwapCopy32(const void *input, void *output, std::size_t count) {
+  using Batch = xsimd::batch<U32>;
+  SwapCopy<U32>(input, output, count, [](Batch value) {
+    return (value << 24) |
+           ((value & Batch(U32(0x0000FF00))) << 8) |
+           ((value >> 8) & Batch(U32(0x0000FF00))) |
+           (value >> 24);
+  });
+}
+void ByteSwapCopy64(const void *input, void *output, std::size_t count) {
+  using Batch = xsimd::batch<U64>;
+  SwapCopy<U64>(input, output, count, [](Batch value) {
+    const auto bytes = Batch(U64(0x00FF00FF00FF00FFULL));
+    const auto words = Batch(U64(0x0000FFFF0000FFFFULL));
+    value = ((value & bytes) << 8)  | ((value >> 8)  & bytes);
+    value = ((value & words) << 16) | ((value >> 16) & words);
+    return (value << 32) | (value >> 32);
+  });
+}
+}; // namespace PSD::llapi::detail
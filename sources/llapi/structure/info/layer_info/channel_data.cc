@@ -1,11 +1,19 @@
 
 #include "psd/llapi/stream.h"
 #include "psd/llapi/structure/header.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <psd/llapi/structure/info/layer_info/channel_data.h>
 #include <libdeflate.h>
 #include <xsimd/xsimd.hpp>
+#include <zlib.h>
 
 #if PSD_COMPILER_MSVC
 #include <intrin.h>
@@ -13,85 +21,273 @@
 
 namespace PSD::llapi {
 //
-template <typename I, typename O>
-void DecompressLine(I input, I end, O output) {
-  while (input != end) {
-    I16 count = static_cast<I8>(*input++);
-    if (count < 0) {
-      count = -count + 1;
-      std::fill(output, output + count, *input++);
+namespace {
+//
+using ByteBatch = xsimd::batch<U8>;
+
+// PackBits runs are at most 128 bytes and both run kinds are written in whole
+// batches, so the fast path needs this much input past the run header.
+constexpr std::size_t RunLimit  = 128;
+constexpr std::size_t FastInput = 1 + RunLimit + ByteBatch::size;
+
+void FillRun(U8 *output, U8 value, std::size_t count) {
+  auto batch = ByteBatch(value);
+  for (auto index = std::size_t(0); index < count; index += ByteBatch::size) {
+    batch.store_unaligned(output + index);
+  }
+}
+void CopyRun(const U8 *input, U8 *output, std::size_t count) {
+  for (auto index = std::size_t(0); index < count; index += ByteBatch::size) {
+    ByteBatch::load_unaligned(input + index).store_unaligned(output + index);
+  }
+}
+// Decodes one PackBits row into [output, limit). Runs are stored as whole
+// batches that may spill up to ByteBatch::size - 1 bytes past their end,
+// the caller keeps that much slack after the last row, and the spill into
+// the next row is overwritten when that row is decoded. Near the end of
+// the input the exact, byte-sized path takes over.
+void DecodeRow(const U8 *input, const U8 *end, U8 *output, U8 *limit) {
+  while (std::size_t(end - input) >= FastInput) {
+    auto header = static_cast<I8>(*input++);
+    if (header >= 0) {
+      std::size_t count = header + 1;
+      if (count > std::size_t(limit - output)) throw Error("PSD::Error: DecompressionError");
+      CopyRun(input, output, count);
+      input  += count;
       output += count;
-    } else {
-      count++;
-      std::copy(input, input + count, output);
+    } else if (header != -128) {
+      std::size_t count = 1 - header;
+      if (count > std::size_t(limit - output)) throw Error("PSD::Error: DecompressionError");
+      FillRun(output, *input++, count);
+      output += count;
+    }
+  }
+  while (input < end) {
+    auto header = static_cast<I8>(*input++);
+    if (header >= 0) {
+      std::size_t count = header + 1;
+      if (count > std::size_t(end   - input) ||
+          count > std::size_t(limit - output)) throw Error("PSD::Error: DecompressionError");
+      std::memcpy(output, input, count);
       input  += count;
       output += count;
+    } else if (header != -128) {
+      std::size_t count = 1 - header;
+      if (input == end ||
+          count > std::size_t(limit - output)) throw Error("PSD::Error: DecompressionError");
+      std::memset(output, *input++, count);
+      output += count;
     }
   }
+  // A short row may have picked up the spill of the previous one.
+  std::fill(output, limit, U8(0));
+}
+// Byte counts preceding RLE rows are 2 bytes wide in PSD and 4 in PSB.
+std::size_t CountWidth(Version version) {
+  return version == Version::PSB ? sizeof(U32) : sizeof(U16);
+}
+std::size_t RowByteCount(const U8 *table, unsigned index, std::size_t width) {
+  auto output = std::size_t(0);
+  for (auto byte = 0u; byte < width; byte++) {
+    output = (output << 8) | table[index * width + byte];
+  }
+  return output;
 }
+// Checks the whole table against the input before any row is decoded,
+// returns where the first row starts.
+std::size_t CheckRowTable(ByteView input, unsigned row_count, std::size_t width) {
+  const auto table_length = std::size_t(row_count) * width;
+  if (input.size() < table_length) {
+    throw Error("PSD::Error: DecompressionError");
+  }
+  auto total = std::size_t(0);
+  for (auto index = 0u;
+            index < row_count;
+            index++) {
+    total += RowByteCount(input.data(), index, width);
+  }
+  if (total > input.size() - table_length) {
+    throw Error("PSD::Error: DecompressionError");
+  }
+  return table_length;
+}
+std::vector<U8> DecompressRows(
+  ByteView    input,
+  unsigned    row_count,
+  unsigned    column_count,
+  Depth       depth,
+  std::size_t width
+) {
+  const auto row_length = std::size_t(column_count) * ByteCount(depth);
+  // Each row may spill up to one batch past its end.
+  std::vector<U8> output(row_count * row_length + ByteBatch::size);
+  auto row = input.data() + CheckRowTable(input, row_count, width);
+  for (auto index = 0u;
+            index < row_count;
+            index++) {
+    auto count = RowByteCount(input.data(), index, width);
+    auto start = output.data() + index * row_length;
+    DecodeRow(row, row + count, start, start + row_length);
+    row += count;
+  }
+  output.resize(row_count * row_length);
+  return output;
+}
+}; // namespace
 std::vector<U8> DecompressDefault(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version version
 ) {
-  std::vector<U8> output(row_count * column_count * ByteCount(depth));
+  return DecompressRows(input, row_count, column_count, depth, CountWidth(version));
+}
+namespace {
+//
+struct FreeDecompressor {
+  void operator()(libdeflate_decompressor *decompressor) const {
+    libdeflate_free_decompressor(decompressor);
+  }
+}; // struct FreeDecompressor
+struct FreeCompressor {
+  void operator()(libdeflate_compressor *compressor) const {
+    libdeflate_free_compressor(compressor);
+  }
+}; // struct FreeCompressor
 
-  auto ooffset = 0ul;
-  auto ioffset = 0ul;
-  auto citerator = input.begin();
+// Free contexts of one kind, shared by every thread. A context is leased for
+// one call and handed back after, so it outlives the thread that allocated it
+// and the pool holds at most as many as ever ran at once.
+template <typename T, typename Free>
+class ContextPool {
+public:
+  using Pointer = std::unique_ptr<T, Free>;
 
-  const auto clength = row_count * sizeof(U16);
-  for (auto index = 0ul;
-            index < row_count;
-            index++) {
-    U16 count = 0;
-    U8 *ccount = reinterpret_cast<U8 *>(&count);
-    #if PSD_LITTLE_ENDIAN
-    ccount[1] = *citerator++;
-    ccount[0] = *citerator++;
-    #else
-    ccount[0] = *citerator++;
-    ccount[1] = *citerator++;
-    #endif
-    DecompressLine(
-      input.begin() + clength + ioffset,
-      input.begin() + clength + ioffset + count,
-      output.begin() + ooffset
-    );
-    ioffset += count;
-    ooffset += column_count * ByteCount(depth);
+  class Lease {
+  public:
+    Lease(ContextPool &pool, Pointer context)
+      : pool_(pool), context_(std::move(context)) {}
+    ~Lease() {
+      pool_.Return(std::move(context_));
+    }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+
+    operator T *() const {
+      return context_.get();
+    }
+  private:
+    ContextPool &pool_;
+    Pointer      context_;
+  }; // class Lease
+
+  template <typename Allocate>
+  Lease Acquire(Allocate allocate) {
+    Pointer context;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        context = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+    if (!context) {
+      context.reset(allocate());
+    }
+    return Lease(*this, std::move(context));
   }
-  return output;
+private:
+  void Return(Pointer context) {
+    if (context) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      free_.push_back(std::move(context));
+    }
+  }
+  std::mutex           mutex_;
+  std::vector<Pointer> free_;
+}; // class ContextPool
+
+using DecompressorPool = ContextPool<libdeflate_decompressor, FreeDecompressor>;
+using CompressorPool   = ContextPool<libdeflate_compressor, FreeCompressor>;
+
+// Codec contexts carry large internal tables, so they are allocated once, one
+// pool per compression level, and reused for every channel after.
+DecompressorPool::Lease LeaseDecompressor() {
+  static DecompressorPool pool;
+  return pool.Acquire([]() {
+    auto output = libdeflate_alloc_decompressor();
+    if (!output) {
+      throw Error("PSD::Error: DecompressorError");
+    }
+    return output;
+  });
+}
+constexpr unsigned MaxLevel = 12;
+
+CompressorPool::Lease LeaseCompressor(unsigned level) {
+  static std::array<CompressorPool, MaxLevel + 1> pools;
+  if (level > MaxLevel) {
+    throw Error("PSD::Error: CompressionError");
+  }
+  return pools[level].Acquire([level]() {
+    auto output = libdeflate_alloc_compressor(level);
+    if (!output) {
+      throw Error("PSD::Error: CompressionError");
+    }
+    return output;
+  });
 }
+}; // namespace
 std::vector<U8> DecompressDeflate(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version
 ) {
-  std::vector<U8> output(row_count * column_count * ByteCount(depth));
-  auto decompressor = libdeflate_alloc_decompressor();
-  if (!decompressor) {
-    throw Error("PSD::Error: DecompressorError");
-  }
+  std::vector<U8> output(std::size_t(row_count) * column_count * ByteCount(depth));
   std::size_t decompressed = 0ul;
   if (libdeflate_zlib_decompress(
-    decompressor,
+    LeaseDecompressor(),
     input.data(),
     input.size(),
     output.data(),
     output.size(),
     &decompressed
   ) != LIBDEFLATE_SUCCESS) {
-    libdeflate_free_decompressor(decompressor);
     throw Error("PSD::Error: DecompressionError");
   };
-  libdeflate_free_decompressor(decompressor);
   return output;
 }
 namespace {
 //
+// In-register inclusive scan, log2(lanes) shifted adds.
+template <typename T, typename A, std::size_t Lanes = 1>
+xsimd::batch<T, A> PrefixSum(xsimd::batch<T, A> value) {
+  if constexpr (Lanes < xsimd::batch<T, A>::size) {
+    return PrefixSum<T, A, Lanes * 2>(value + xsimd::slide_left<Lanes * sizeof(T)>(value));
+  } else {
+    return value;
+  }
+}
+// Running sum of one row, the last lane of every batch is carried into the
+// next. Rows share no state, so any subset of them can be decoded apart.
+template <typename T>
+void DecodeDeltaRow(const T *input, T *output, std::size_t count) {
+  using Batch = xsimd::batch<T>;
+  auto carry = T(0);
+  auto index = std::size_t(0);
+  for (; index + Batch::size <= count;
+         index += Batch::size) {
+    auto value = PrefixSum(Batch::load_unaligned(input + index)) + Batch(carry);
+    value.store_unaligned(output + index);
+    carry = output[index + Batch::size - 1];
+  }
+  for (; index < count; index++) {
+    carry = output[index] = T(input[index] + carry);
+  }
+}
 void DecodeDelta8(
   std::vector<U8> &data,
   unsigned row_count,
@@ -100,12 +296,8 @@ void DecodeDelta8(
   for (auto row = 0u;
             row < row_count;
             row++) {
-    auto offset = row * column_count;
-    for (auto column = 1u;
-              column < (column_count);
-              column++) {
-      data[offset + column] += data[offset + column - 1];
-    }
+    auto offset = data.data() + std::size_t(row) * column_count;
+    DecodeDeltaRow(offset, offset, column_count);
   }
 }
 void DecodeDelta16(
@@ -113,77 +305,70 @@ void DecodeDelta16(
   unsigned row_count,
   unsigned column_count
 ) {
-  auto &data16 = reinterpret_cast<std::vector<U16> &>(data);
-  #ifdef PSD_LITTLE_ENDIAN
-  for (auto &value : data16)  value = detail::ByteSwap(value);
-  #endif
   for (auto row = 0u;
             row < row_count;
             row++) {
-    auto offset = row * column_count;
-    for (auto column = 1u;
-              column < (column_count);
-              column++) {
-      data16[offset + column] += data16[offset + column - 1];
-    }
+    auto offset = reinterpret_cast<U16 *>(data.data()) + std::size_t(row) * column_count;
+    detail::SwapRangeLE<U16>(offset, offset, column_count);
+    DecodeDeltaRow(offset, offset, column_count);
   }
 }
-std::vector<U8> Deinterleave(
-  const std::vector<U8> &input,
-  unsigned row_count,
-  unsigned column_count
-) {
-  std::vector<U8> output(input.size());
-  for (auto row = 0u;
-            row < row_count;
-            row++) {
-    for (auto column = 0u;
-              column < (column_count);
-              column++) {
-      unsigned offset = row * column_count * sizeof(F32);
-      output[offset + (column * sizeof(F32)) + 0] = input[offset + column];
-      output[offset + (column * sizeof(F32)) + 1] = input[offset + (column_count) * 1 + column];
-      output[offset + (column * sizeof(F32)) + 2] = input[offset + (column_count) * 2 + column];
-      output[offset + (column * sizeof(F32)) + 3] = input[offset + (column_count) * 3 + column];
-    }
+// Gathers the four big-endian byte planes of a row into native 32-bit
+// samples, which also takes care of the byte order.
+void ComposeRow(const U8 *planes, U32 *output, std::size_t column_count) {
+  using Batch = xsimd::batch<U32>;
+  const auto *plane0 = planes;
+  const auto *plane1 = planes + column_count;
+  const auto *plane2 = planes + column_count * 2;
+  const auto *plane3 = planes + column_count * 3;
+  auto column = std::size_t(0);
+  for (; column + Batch::size <= column_count;
+         column += Batch::size) {
+    auto value = (Batch::load_unaligned(plane0 + column) << 24) |
+                 (Batch::load_unaligned(plane1 + column) << 16) |
+                 (Batch::load_unaligned(plane2 + column) << 8)  |
+                  Batch::load_unaligned(plane3 + column);
+    value.store_unaligned(output + column);
+  }
+  for (; column < column_count; column++) {
+    output[column] = (U32(plane0[column]) << 24) |
+                     (U32(plane1[column]) << 16) |
+                     (U32(plane2[column]) << 8)  |
+                      U32(plane3[column]);
   }
-  return output;
 }
+// Delta, deinterleave and byte order in one pass per row. The summed planes
+// go through a row-sized scratch buffer that stays in cache.
 void DecodeDelta32(
   std::vector<U8> &data,
   unsigned row_count,
   unsigned column_count
 ) {
-  auto index = 0u;
+  const auto row_length = std::size_t(column_count) * sizeof(F32);
+  std::vector<U8> planes(row_length);
   for (auto row = 0u;
             row < row_count;
             row++) {
-    index++;
-    for (auto column = 1u;
-              column < (column_count * sizeof(F32));
-              column++) {
-      data[index] += data[index-1];
-      index++;
-    }
+    auto offset = data.data() + row * row_length;
+    DecodeDeltaRow(offset, planes.data(), row_length);
+    ComposeRow(planes.data(), reinterpret_cast<U32 *>(offset), column_count);
   }
-  data = Deinterleave(data, row_count, column_count);
-  #ifdef PSD_LITTLE_ENDIAN
-  for (auto &value : reinterpret_cast<std::vector<U32> &>(data)) value = detail::ByteSwap(value);
-  #endif
 }
 }; // namespace
 std::vector<U8>
 DecompressDeflateDelta(
-  const std::vector<U8> &input,
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth
+  Depth depth,
+  Version
 ) {
   auto decompressed = DecompressDeflate(
     input,
     row_count,
     column_count,
-    depth
+    depth,
+    Version::PSD
   );
   auto decode_delta = [&](auto function) {
     return function(
@@ -284,87 +469,203 @@ void InsertCompressed(
     }
   }
 }
-std::vector<U8> CompressDefault(
-  const std::vector<U8> &input,
+namespace {
+//
+template <typename C>
+std::vector<U8> CompressRows(
+  ByteView input,
   unsigned row_count,
   unsigned column_count,
-  Depth depth,
-  unsigned
+  Depth depth
 ) {
-  std::vector<U8> output(row_count * sizeof(U16));
+  const auto row_length = std::size_t(column_count) * ByteCount(depth);
+  std::vector<U8> output(row_count * sizeof(C));
   auto iterator = input.begin();
-  output.reserve(output.size() + row_count * column_count);
+  output.reserve(output.size() + row_count * row_length);
   for (auto index = 0u;
             index < row_count;
             index++) {
-      union {
-          U16 value; U8 array[2];
-      } count;
       auto before_insert = output.size();
       InsertCompressed(
         output,
         iterator,
-        iterator + column_count
+        iterator + row_length
       );
-      iterator += column_count;
-      count.value = output.size() - before_insert;
-#if PSD_LITTLE_ENDIAN
-      output[(index * 2) + 0] = count.array[1];
-      output[(index * 2) + 1] = count.array[0];
-#else
-      output[(index * 2) + 0] = count.array[0];
-      output[(index * 2) + 1] = count.array[1];
-#endif
+      iterator += row_length;
+      C count = output.size() - before_insert;
+      for (auto byte = sizeof(C); byte--;) {
+        output[index * sizeof(C) + byte] = U8(count);
+        count >>= 8;
+      }
   }
   return output;
 }
-std::vector<U8>
-CompressDeflate(
-  const std::vector<U8> &input,
-  unsigned,
+}; // namespace
+std::vector<U8> CompressDefault(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count,
+  Depth depth,
   unsigned,
-  Depth,
-  unsigned level
+  Version version
 ) {
-  auto compressor = libdeflate_alloc_compressor(level);
-  if (!compressor) {
+  if (version == Version::PSB) {
+    return CompressRows<U32>(input, row_count, column_count, depth);
+  }
+  return CompressRows<U16>(input, row_count, column_count, depth);
+}
+namespace {
+//
+struct FreeDeflater {
+  void operator()(z_stream *stream) const {
+    deflateEnd(stream);
+    delete stream;
+  }
+}; // struct FreeDeflater
+
+using DeflaterPool = ContextPool<z_stream, FreeDeflater>;
+
+// zlib stops at level 9, higher levels of libdeflate are served by it.
+constexpr unsigned MaxDeflaterLevel = 9;
+constexpr std::size_t WindowLength  = std::size_t(1) << 15;
+
+// Raw deflate streams of zlib for chunks, pooled like the libdeflate
+// contexts. Leased streams are reset by the caller.
+DeflaterPool::Lease LeaseDeflater(unsigned level) {
+  static std::array<DeflaterPool, MaxDeflaterLevel + 1> pools;
+  level = std::min(level, MaxDeflaterLevel);
+  return pools[level].Acquire([level]() {
+    auto output = std::make_unique<z_stream>();
+    if (deflateInit2(output.get(), int(level), Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw Error("PSD::Error: CompressionError");
+    }
+    return output.release();
+  });
+}
+// Deflates one chunk as raw deflate, primed with the window before it so
+// matches reach across the seam as they would in a single stream. Every
+// chunk but the last ends on a sync flush, byte aligned for the next one.
+std::vector<U8> DeflateChunk(ByteView input, ByteView window, unsigned level, bool last) {
+  auto deflater = LeaseDeflater(level);
+  z_stream &stream = *deflater;
+  if (deflateReset(&stream) != Z_OK ||
+      (!window.empty() && deflateSetDictionary(&stream, window.data(), uInt(window.size())) != Z_OK)) {
     throw Error("PSD::Error: CompressionError");
   }
+  std::vector<U8> output(deflateBound(&stream, uLong(input.size())) + 16);
+  stream.next_in  = const_cast<U8 *>(input.data());
+  stream.avail_in = uInt(input.size());
+  for (auto written = std::size_t(0);;) {
+    stream.next_out  = output.data() + written;
+    stream.avail_out = uInt(output.size() - written);
+    auto result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    written = output.size() - stream.avail_out;
+    if (result == Z_STREAM_END || (!last && result == Z_OK && stream.avail_out)) {
+      output.resize(written);
+      return output;
+    }
+    if (result != Z_OK && result != Z_BUF_ERROR) {
+      throw Error("PSD::Error: CompressionError");
+    }
+    output.resize(output.size() * 2);
+  }
+}
+// Adler-32 of two ranges joined, from the sums of each, as zlib's
+// adler32_combine.
+U32 CombineAdler(U32 first, U32 second, std::size_t second_length) {
+  constexpr U32 Base = 65521;
+  auto remainder = U32(second_length % Base);
+  auto low  = first & 0xFFFF;
+  auto high = U32((U64(remainder) * low) % Base);
+  low  += (second & 0xFFFF) + Base - 1;
+  high += (first >> 16) + (second >> 16) + Base - remainder;
+  if (low  >= Base)      low  -= Base;
+  if (low  >= Base)      low  -= Base;
+  if (high >= Base << 1) high -= Base << 1;
+  if (high >= Base)      high -= Base;
+  return (high << 16) | low;
+}
+}; // namespace
+void DeflateChunks::Compress(std::size_t index) {
+  auto offset = index * DeflateChunkLength;
+  auto chunk  = ByteView(input_.data() + offset, std::min(DeflateChunkLength, input_.size() - offset));
+  auto window = ByteView(chunk.data() - std::min(WindowLength, offset), std::min(WindowLength, offset));
+  chunks_[index] = DeflateChunk(chunk, window, level_, index + 1 == chunks_.size());
+  sums_  [index] = U32(libdeflate_adler32(1, chunk.data(), chunk.size()));
+}
+std::vector<U8> DeflateChunks::Join() const {
+  // Same header libdeflate_zlib_compress writes for `level`.
+  auto header = 0x7800u | ((level_ < 2 ? 0u : level_ < 6 ? 1u : level_ < 8 ? 2u : 3u) << 6);
+  header     += 31 - header % 31;
+  std::vector<U8> output = {U8(header >> 8), U8(header)};
+  auto sum = sums_.empty() ? U32(1) : sums_[0];
+  for (auto index = std::size_t(0); index < chunks_.size(); index++) {
+    output.insert(output.end(), chunks_[index].begin(), chunks_[index].end());
+    if (index) {
+      auto offset = index * DeflateChunkLength;
+      sum = CombineAdler(sum, sums_[index], std::min(DeflateChunkLength, input_.size() - offset));
+    }
+  }
+  for (auto shift : {24, 16, 8, 0}) {
+    output.push_back(U8(sum >> shift));
+  }
+  return output;
+}
+std::vector<U8>
+CompressDeflate(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count,
+  Depth depth,
+  unsigned level,
+  Version,
+  Executor *executor
+) {
+  if (executor && DeflateChunks::Splits(input.size())) {
+    DeflateChunks chunks(input, row_count, column_count, depth, Compression::Deflate, level);
+    std::vector<Job> jobs;
+    for (auto index = std::size_t(0); index < chunks.Count(); index++) {
+      jobs.push_back([&chunks, index]() {
+        chunks.Compress(index);
+      });
+    }
+    executor->Run(jobs);
+    return chunks.Join();
+  }
+  auto compressor = LeaseCompressor(level);
   std::vector<U8> output(libdeflate_zlib_compress_bound(compressor, input.size()));
-  auto length = libdeflate_deflate_compress(
+  auto length = libdeflate_zlib_compress(
     compressor,
     input.data(),
     input.size(),
-    output.data() + 2,
-    output.size() - 6
+    output.data(),
+    output.size()
   );
   if (!length) {
-    libdeflate_free_compressor(compressor);
     throw Error("PSD::Error: CompressionError");
   }
-  output.resize(length + 6);
-  output[0] = 0x78;
-  output[1] = 0xDA;
-  union {
-    U32 value;
-    U8  array[sizeof value];
-  } adler;
-  adler.value = libdeflate_adler32(1, output.data() + 2, output.size() - 6);
-  #if PSD_LITTLE_ENDIAN
-    output[output.size()-1] = adler.array[0];
-    output[output.size()-2] = adler.array[1];
-    output[output.size()-3] = adler.array[2];
-    output[output.size()-4] = adler.array[3];
-  #else
-    output[output.size()-1] = adler.array[3];
-    output[output.size()-2] = adler.array[2];
-    output[output.size()-3] = adler.array[1];
-    output[output.size()-4] = adler.array[0];
-  #endif
-  libdeflate_free_compressor(compressor);
+  output.resize(length);
   return output;
 }
 namespace {
+//
+// Replaces every sample of the row but the first by its difference to the
+// previous one. The row is walked backwards so each batch still reads the
+// original values of its left neighbours.
+template <typename T>
+void EncodeDeltaRow(T *row, std::size_t count) {
+  using Batch = xsimd::batch<T>;
+  auto index = count;
+  while (index >= Batch::size + 1) {
+    index -= Batch::size;
+    auto current  = Batch::load_unaligned(row + index);
+    auto previous = Batch::load_unaligned(row + index - 1);
+    (current - previous).store_unaligned(row + index);
+  }
+  for (; index > 1; index--) {
+    row[index - 1] -= row[index - 2];
+  }
+}
 void EncodeDelta8(
   std::vector<U8> &data,
   unsigned row_count,
@@ -373,44 +674,506 @@ void EncodeDelta8(
   for (auto row = 0u;
             row < row_count;
             row++) {
-    auto offset   = row * column_count;
-    auto previous = data[offset];
-    for (auto column = 1u;
+    EncodeDeltaRow(data.data() + std::size_t(row) * column_count, column_count);
+  }
+}
+// Inverse of DecodeDelta16, takes native samples and leaves big-endian ones.
+void EncodeDelta16(
+  std::vector<U8> &data,
+  unsigned row_count,
+  unsigned column_count
+) {
+  auto data16 = reinterpret_cast<U16 *>(data.data());
+  for (auto row = 0u;
+            row < row_count;
+            row++) {
+    EncodeDeltaRow(data16 + std::size_t(row) * column_count, column_count);
+  }
+  detail::SwapRangeLE<U16>(data.data(), data.data(), data.size() / sizeof(U16));
+}
+std::vector<U8> Interleave(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count
+) {
+  std::vector<U8> output(input.size());
+  for (auto row = 0u;
+            row < row_count;
+            row++) {
+    auto offset = std::size_t(row) * column_count * sizeof(F32);
+    for (auto column = 0u;
               column < (column_count);
-              column++)
-    {
-      auto current = data[offset + column];
-      data[offset + column] -= previous;
-      previous = current;
+              column++) {
+      output[offset + (column_count) * 0 + column] = input[offset + (column * sizeof(F32)) + 0];
+      output[offset + (column_count) * 1 + column] = input[offset + (column * sizeof(F32)) + 1];
+      output[offset + (column_count) * 2 + column] = input[offset + (column * sizeof(F32)) + 2];
+      output[offset + (column_count) * 3 + column] = input[offset + (column * sizeof(F32)) + 3];
     }
   }
+  return output;
 }
-} // namespace
-std::vector<U8> CompressDeflateDelta(
-  const std::vector<U8> &input,
+// Inverse of DecodeDelta32: native floats are made big-endian, split into
+// byte planes per row, and the planes are delta coded as one byte row.
+void EncodeDelta32(
+  std::vector<U8> &data,
   unsigned row_count,
-  unsigned column_count,
-  Depth depth,
-  unsigned level
+  unsigned column_count
 ) {
-  auto encoded = input;
+  detail::SwapRangeLE<U32>(data.data(), data.data(), data.size() / sizeof(U32));
+  data = Interleave(data, row_count, column_count);
+  for (auto row = 0u;
+            row < row_count;
+            row++) {
+    EncodeDeltaRow(
+      data.data() + std::size_t(row) * column_count * sizeof(F32),
+      std::size_t(column_count) * sizeof(F32)
+    );
+  }
+}
+std::vector<U8> EncodeDelta(ByteView input, unsigned row_count, unsigned column_count, Depth depth) {
+  std::vector<U8> output(input.begin(), input.end());
   auto encode_delta = [&](auto function) {
     return function(
-      encoded,
+      output,
       row_count,
       column_count
     );
   };
   switch (depth) {
-    case Depth::Eight: encode_delta(EncodeDelta8); break;
+    case Depth::Eight     : encode_delta(EncodeDelta8); break;
+    case Depth::Sixteen   : encode_delta(EncodeDelta16); break;
+    case Depth::ThirtyTwo : encode_delta(EncodeDelta32); break;
     default: throw Error("EncodeDeltaErr");
   }
+  return output;
+}
+} // namespace
+DeflateChunks::DeflateChunks(
+  ByteView    input,
+  unsigned    row_count,
+  unsigned    column_count,
+  Depth       depth,
+  Compression compression,
+  unsigned    level
+) : level_(level) {
+  if (compression == Compression::DeflateDelta) {
+    encoded_ = EncodeDelta(input, row_count, column_count, depth);
+    input    = encoded_;
+  } else if (compression != Compression::Deflate) {
+    throw Error("PSD::Error: UnsupportedCompression");
+  }
+  input_ = input;
+  auto chunk_count = (input.size() + DeflateChunkLength - 1) / DeflateChunkLength;
+  chunks_.resize(chunk_count);
+  sums_  .resize(chunk_count);
+}
+std::vector<U8> CompressDeflateDelta(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count,
+  Depth depth,
+  unsigned level,
+  Version version,
+  Executor *executor
+) {
+  auto encoded = EncodeDelta(input, row_count, column_count, depth);
   return CompressDeflate(
     encoded,
     row_count,
     column_count,
     depth,
-    level
+    level,
+    version,
+    executor
   );
 }
+Compression ChooseCompression(
+  ByteView input,
+  unsigned row_count,
+  unsigned column_count,
+  Depth depth,
+  unsigned level,
+  Version version,
+  const AdaptiveBudget &budget
+) {
+  const auto row_length = std::size_t(column_count) * ByteCount(depth);
+  if (input.empty() || !row_length) {
+    return Compression::None;
+  }
+  auto sample_rows = row_count;
+  auto sample      = std::vector<U8>();
+  auto view        = input;
+  if (budget.sample_rows && row_count > budget.sample_rows) {
+    sample_rows = budget.sample_rows;
+    sample.resize(sample_rows * row_length);
+    for (auto index = 0u;
+              index < sample_rows;
+              index++) {
+      auto row = std::size_t(index) * row_count / sample_rows;
+      std::memcpy(sample.data() + index * row_length, input.data() + row * row_length, row_length);
+    }
+    view = sample;
+  }
+  auto output = Compression::None;
+  auto length = F32(view.size());
+  for (auto candidate : {Compression::Default, Compression::Deflate, Compression::DeflateDelta}) {
+    if (candidate > budget.ceiling) {
+      break;
+    }
+    auto trial = Compress(view, sample_rows, column_count, depth, candidate, level, version).size();
+    if (trial <= length * (1 - budget.min_saving)) {
+      output = candidate;
+      length = F32(trial);
+    }
+  }
+  return output;
+}
+namespace {
+//
+// Runs `kernel` over whole batches and `scalar` over the remaining tail.
+template <typename Batch, typename I, typename O, typename K, typename S>
+void ConvertBatches(const I *input, O *output, std::size_t count, K kernel, S scalar) {
+  auto index = std::size_t(0);
+  for (; index + Batch::size <= count;
+         index += Batch::size) {
+    kernel(Batch::load_unaligned(input + index)).store_unaligned(output + index);
+  }
+  for (; index < count; index++) {
+    output[index] = scalar(input[index]);
+  }
+}
+template <typename T>
+T Clamp(T value) {
+  return xsimd::min(xsimd::max(value, T(0.0f)), T(1.0f));
+}
+}; // namespace
+void ConvertSamples(const U8 *input, U16 *output, std::size_t count) {
+  using Batch = xsimd::batch<U16>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    return value * Batch(U16(0x101));
+  }, [](U8 value) {
+    return U16(value * 0x101);
+  });
+}
+void ConvertSamples(const U8 *input, F32 *output, std::size_t count) {
+  using Batch = xsimd::batch<F32>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    return value / Batch(255.0f);
+  }, [](U8 value) {
+    return F32(value) / 255.0f;
+  });
+}
+// With t = x * 255 + 32768, which stays below 2^24, (t + (t >> 16)) >> 16
+// equals (x * 255 + 32767) / 65535 for every 16-bit x.
+void ConvertSamples(const U16 *input, U8 *output, std::size_t count) {
+  using Batch = xsimd::batch<U32>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    value = value * Batch(255u) + Batch(32768u);
+    return (value + (value >> 16)) >> 16;
+  }, [](U16 value) {
+    return U8((U32(value) * 255 + 32767) / 65535);
+  });
+}
+void ConvertSamples(const U16 *input, F32 *output, std::size_t count) {
+  using Batch = xsimd::batch<F32>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    return value / Batch(65535.0f);
+  }, [](U16 value) {
+    return F32(value) / 65535.0f;
+  });
+}
+void ConvertSamples(const F32 *input, U8 *output, std::size_t count) {
+  using Batch = xsimd::batch<F32>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    return xsimd::fma(Clamp(value), Batch(255.0f), Batch(0.5f));
+  }, [](F32 value) {
+    return U8(std::fma(std::min(std::max(value, 0.0f), 1.0f), 255.0f, 0.5f));
+  });
+}
+void ConvertSamples(const F32 *input, U16 *output, std::size_t count) {
+  using Batch = xsimd::batch<F32>;
+  ConvertBatches<Batch>(input, output, count, [](Batch value) {
+    return xsimd::fma(Clamp(value), Batch(65535.0f), Batch(0.5f));
+  }, [](F32 value) {
+    return U16(std::fma(std::min(std::max(value, 0.0f), 1.0f), 65535.0f, 0.5f));
+  });
+}
+struct RowDecoder::Inflater {
+  z_stream stream = {};
+
+  Inflater() {
+    if (inflateInit(&stream) != Z_OK) {
+      throw Error("PSD::Error: DecompressorError");
+    }
+  }
+  ~Inflater() {
+    inflateEnd(&stream);
+  }
+  Inflater(const Inflater &) = delete;
+  Inflater &operator=(const Inflater &) = delete;
+}; // struct RowDecoder::Inflater
+
+RowDecoder::~RowDecoder() = default;
+RowDecoder::RowDecoder(RowDecoder &&) noexcept = default;
+RowDecoder &RowDecoder::operator=(RowDecoder &&) noexcept = default;
+
+RowDecoder::RowDecoder(
+  ByteView    input,
+  Compression compression,
+  unsigned    row_count,
+  unsigned    column_count,
+  Depth       depth,
+  Version     version,
+  std::size_t inflate_limit
+) : input_        (input),
+    compression_  (compression),
+    row_count_    (row_count),
+    column_count_ (column_count),
+    depth_        (depth),
+    count_width_  (CountWidth(version)),
+    row_length_   (std::size_t(column_count) * ByteCount(depth)) {
+  if (depth == Depth::One) {
+    throw Error("PSD::Error: UnsupportedDepth");
+  }
+  switch (compression) {
+    case Compression::None:
+      if (input.size() < row_count * row_length_) {
+        throw Error("PSD::Error: DecompressionError");
+      }
+      break;
+    case Compression::Default:
+      position_ = CheckRowTable(input, row_count, count_width_);
+      break;
+    case Compression::Deflate:
+    case Compression::DeflateDelta:
+      if (row_count * row_length_ <= inflate_limit) {
+        inflated_ = DecompressDeflate(input, row_count, column_count, depth, version);
+      } else {
+        inflater_ = std::make_unique<Inflater>();
+        inflated_.resize(row_length_);
+      }
+      break;
+    default:
+      throw Error("PSD::Error: UnsupportedCompression");
+  }
+  row_buffer_.resize(row_length_ + ByteBatch::size);
+}
+// Row `row_` of the inflated channel. Streamed channels inflate it now,
+// feeding zlib at most what its 32-bit counters can take at a time.
+U8 *RowDecoder::InflatedRow() {
+  if (!inflater_) {
+    return inflated_.data() + row_ * row_length_;
+  }
+  auto &stream    = inflater_->stream;
+  stream.next_out  = inflated_.data();
+  stream.avail_out = uInt(row_length_);
+  while (stream.avail_out) {
+    if (!stream.avail_in) {
+      auto remaining = input_.size() - position_;
+      stream.next_in  = const_cast<Bytef *>(input_.data() + position_);
+      stream.avail_in = uInt(std::min<std::size_t>(remaining, std::numeric_limits<uInt>::max()));
+      position_      += stream.avail_in;
+    }
+    auto result = inflate(&stream, Z_NO_FLUSH);
+    if (result == Z_STREAM_END && stream.avail_out) {
+      throw Error("PSD::Error: DecompressionError");
+    }
+    if (result != Z_OK && result != Z_STREAM_END) {
+      throw Error("PSD::Error: DecompressionError");
+    }
+  }
+  return inflated_.data();
+}
+ByteView RowDecoder::Next() {
+  if (Done()) {
+    throw Error("PSD::Error: DecompressionError");
+  }
+  auto output = row_buffer_.data();
+  switch (compression_) {
+    case Compression::None:
+      std::memcpy(output, input_.data() + position_, row_length_);
+      position_ += row_length_;
+      break;
+    case Compression::Default: {
+      auto count = RowByteCount(input_.data(), row_, count_width_);
+      DecodeRow(input_.data() + position_, input_.data() + position_ + count, output, output + row_length_);
+      position_ += count;
+      break;
+    }
+    case Compression::Deflate:
+      output = InflatedRow();
+      break;
+    default:
+      output = InflatedRow();
+      switch (depth_) {
+        case Depth::Eight:
+          DecodeDeltaRow(output, output, column_count_);
+          break;
+        case Depth::Sixteen: {
+          auto samples = reinterpret_cast<U16 *>(output);
+          detail::SwapRangeLE<U16>(samples, samples, column_count_);
+          DecodeDeltaRow(samples, samples, column_count_);
+          break;
+        }
+        default:
+          DecodeDeltaRow(output, row_buffer_.data(), row_length_);
+          ComposeRow(row_buffer_.data(), reinterpret_cast<U32 *>(output), column_count_);
+          break;
+      }
+      row_++;
+      return ByteView(output, row_length_);
+  }
+  // Everything but the delta filter leaves samples in file order.
+  switch (depth_) {
+    case Depth::Sixteen:
+      detail::SwapRangeLE<U16>(output, output, column_count_);
+      break;
+    case Depth::ThirtyTwo:
+      detail::SwapRangeLE<U32>(output, output, column_count_);
+      break;
+    default:
+      break;
+  }
+  row_++;
+  return ByteView(output, row_length_);
+}
+void RowDecoder::Skip(unsigned count) {
+  if (count > row_count_ - row_) {
+    throw Error("PSD::Error: DecompressionError");
+  }
+  switch (compression_) {
+    case Compression::None:
+      position_ += count * row_length_;
+      break;
+    case Compression::Default:
+      for (auto index = 0u; index < count; index++) {
+        position_ += RowByteCount(input_.data(), row_ + index, count_width_);
+      }
+      break;
+    default:
+      // Streamed rows have to be inflated to get past them.
+      if (inflater_) {
+        for (auto index = 0u; index < count; index++, row_++) {
+          InflatedRow();
+        }
+        return;
+      }
+      break;
+  }
+  row_ += count;
+}
+namespace {
+//
+// Writes one decoded row as 8-bit samples `stride` bytes apart. Deeper
+// rows go through ConvertSamples into `scratch` first.
+void EmitRow(
+  const U8   *input,
+  unsigned    column_count,
+  Depth       depth,
+  U8         *scratch,
+  U8         *output,
+  std::size_t stride
+) {
+  switch (depth) {
+    case Depth::Eight:
+      break;
+    case Depth::Sixteen:
+      ConvertSamples(reinterpret_cast<const U16 *>(input), scratch, column_count);
+      input = scratch;
+      break;
+    default:
+      ConvertSamples(reinterpret_cast<const F32 *>(input), scratch, column_count);
+      input = scratch;
+      break;
+  }
+  for (auto column = 0u; column < column_count; column++) {
+    output[column * stride] = input[column];
+  }
+}
+// Same as EmitRow for the mean of every `factor` columns.
+template <typename T, typename F>
+void EmitBoxRow(
+  const U8   *input,
+  unsigned    column_count,
+  unsigned    factor,
+  U8         *output,
+  std::size_t stride,
+  F           convert
+) {
+  for (auto begin = 0u; begin < column_count; begin += factor) {
+    auto end = std::min(begin + factor, column_count);
+    auto sum = 0.0;
+    for (auto column = begin; column < end; column++) {
+      T value;
+      std::memcpy(&value, input + column * sizeof(T), sizeof(T));
+      sum += value;
+    }
+    *output = convert(sum / (end - begin));
+    output += stride;
+  }
+}
+void EmitBoxRow(
+  const U8   *input,
+  unsigned    column_count,
+  Depth       depth,
+  unsigned    factor,
+  U8         *output,
+  std::size_t stride
+) {
+  switch (depth) {
+    case Depth::Eight:
+      EmitBoxRow<U8>(input, column_count, factor, output, stride, [](double value) {
+        return U8(value + 0.5);
+      });
+      break;
+    case Depth::Sixteen:
+      EmitBoxRow<U16>(input, column_count, factor, output, stride, [](double value) {
+        return U8((U32(value + 0.5) * 255 + 32767) / 65535);
+      });
+      break;
+    default:
+      EmitBoxRow<F32>(input, column_count, factor, output, stride, [](double value) {
+        return U8(std::min(std::max(value, 0.0), 1.0) * 255.0 + 0.5);
+      });
+      break;
+  }
+}
+}; // namespace
+void DecodeChannelTo(
+  ByteView    input,
+  Compression compression,
+  unsigned    row_count,
+  unsigned    column_count,
+  Depth       depth,
+  Version     version,
+  U8         *output,
+  std::size_t stride
+) {
+  RowDecoder decoder(input, compression, row_count, column_count, depth, version);
+  DecodeChannelTo(decoder, row_count, 1, output, stride);
+}
+void DecodeChannelTo(
+  RowDecoder &input,
+  unsigned    row_count,
+  unsigned    factor,
+  U8         *output,
+  std::size_t stride
+) {
+  if (!factor) {
+    throw Error("PSD::Error: DecompressionError");
+  }
+  const auto column_count = input.ColumnCount();
+  const auto row_stride   = std::size_t((column_count + factor - 1) / factor) * stride;
+  std::vector<U8> scratch(column_count);
+  for (auto row = 0u; row < row_count; row += factor) {
+    auto data = input.Next().data();
+    if (factor == 1) {
+      EmitRow(data, column_count, input.SampleDepth(), scratch.data(), output, stride);
+    } else {
+      EmitBoxRow(data, column_count, input.SampleDepth(), factor, output, stride);
+    }
+    output += row_stride;
+    input.Skip(std::min(factor, row_count - row) - 1);
+  }
+}
 }; // namespace PSD::llapi
@@ -0,0 +1,409 @@
+#include "fixture.h"
+
+#include <gtest/gtest.h>
+#include <psd/document.h>
+#include <psd/llapi/index.h>
+
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <utility>
+
+using namespace PSD::llapi;
+
+class DocumentTest : public ::testing::Test {
+protected:
+    std::vector<std::vector<U8>> ChannelBytes() const {
+        std::vector<std::vector<U8>> output;
+        Stream stream(path_);
+        for (const auto &layer : IndexFrom(path_).layers) {
+            for (const auto &channel : layer.channels) {
+                stream.SetPos(channel.range.offset);
+                auto bytes = stream.Borrow(channel.range.length);
+                output.emplace_back(bytes.begin(), bytes.end());
+            }
+        }
+        return output;
+    }
+    Fixture::TemporaryPath path_{"document_test.psd"};
+};
+
+TEST_F(DocumentTest, ResaveReusesCleanChannels) {
+    PSD::Document document;
+    document.Push(PSD::Layer("first", Fixture::PatternImage(9, 11, 1)));
+    document.Push(PSD::Layer("second", Fixture::PatternImage(9, 11, 2)));
+    document.SetCompression(Compression::Deflate);
+    PSD::Save(document, path_);
+    auto original = ChannelBytes();
+
+    EXPECT_EQ(PSD::Open(path_).Compression(), Compression::None);
+
+    // Reused channels keep their bytes, even at another compression level.
+    PSD::OpenOptions options;
+    options.reuse_channels   = true;
+    options.keep_compression = true;
+    auto opened = PSD::Open(path_, options);
+    EXPECT_EQ(opened.Compression(), Compression::Deflate);
+    opened.SetCompressionLevel(1);
+    (*PSD::LayerCast(opened[1]).Edit())[0][0] ^= 0xFF;
+    PSD::Save(opened, path_);
+    auto resaved = ChannelBytes();
+
+    // Channels are stored alpha first, the edit only touched red of "second".
+    ASSERT_EQ(resaved.size(), original.size());
+    for (unsigned channel = 0; channel < resaved.size(); ++channel) {
+        if (channel == 5) {
+            EXPECT_NE(resaved[channel], original[channel]);
+        } else {
+            EXPECT_EQ(resaved[channel], original[channel]);
+        }
+    }
+    EXPECT_TRUE(PSD::Open(path_) == opened);
+}
+
+TEST_F(DocumentTest, AdaptiveSaveStoresRealCodecs) {
+    PSD::Document document;
+    document.Push(PSD::Layer("pattern", Fixture::PatternImage(9, 11)));
+    document.Push(PSD::Layer("empty", ::Image::Buffer<>(9, 11)));
+
+    PSD::SaveStatistics statistics;
+    PSD::SaveOptions options;
+    options.adaptive   = AdaptiveBudget();
+    options.statistics = &statistics;
+    PSD::Save(document, path_, options);
+
+    auto channel_count = 0u;
+    for (const auto &[compression, tally] : statistics.compression) {
+        EXPECT_LE(U16(compression), U16(Compression::DeflateDelta));
+        channel_count += tally.channel_count;
+    }
+    EXPECT_EQ(channel_count, 2 * 4 + 1u);
+    EXPECT_TRUE(PSD::Open(path_) == document);
+}
+
+TEST_F(DocumentTest, PreviewSkipsRowsAndAveragesColumns) {
+    ::Image::Buffer<> image(37, 50);
+    for (unsigned index = 0; index < image.Length(); ++index) {
+        for (unsigned channel = 0; channel < 4; ++channel) {
+            image[index][channel] = static_cast<U8>((index % 50) * 5 + index / 50 + channel);
+        }
+    }
+    PSD::Document document;
+    document.Push(PSD::Layer("layer", image));
+    document.SetCompression(Compression::Default);
+    document.ToggleRendering();
+    PSD::Save(document, path_);
+
+    auto full    = PSD::Decode(path_);
+    auto preview = PSD::Decode(path_, PSD::DecodeOptions{1, 10, 20});
+    ASSERT_EQ(preview.RowCount(), 10u);
+    ASSERT_EQ(preview.ColumnCount(), 13u);
+    for (unsigned row = 0; row < preview.RowCount(); ++row) {
+        for (unsigned column = 0; column < preview.ColumnCount(); ++column) {
+            for (unsigned channel = 0; channel < preview.ChannelCount(); ++channel) {
+                unsigned sum = 0, count = 0;
+                for (unsigned source = column * 4; source < std::min(column * 4 + 4, 50u); ++source) {
+                    sum += full[row * 4 * 50 + source][channel];
+                    count++;
+                }
+                EXPECT_EQ(preview[row * preview.ColumnCount() + column][channel],
+                          static_cast<U8>(static_cast<double>(sum) / count + 0.5));
+            }
+        }
+    }
+}
+
+TEST_F(DocumentTest, NativeOpenKeepsGrayscalePlanes) {
+    PSD::Document document;
+    document.Push(PSD::Layer("layer", Fixture::PatternImage(9, 11, 3)));
+    document.SetColor(PSD::Color::Grayscale);
+    PSD::Save(document, path_);
+
+    PSD::OpenOptions options;
+    options.native = true;
+    auto native = PSD::Open(path_, options);
+    EXPECT_EQ(native.Color(), PSD::Color::Grayscale);
+
+    const auto &layer = PSD::LayerCast(std::as_const(native)[0]);
+    ASSERT_NE(layer.Pixels(), nullptr);
+    EXPECT_EQ(layer.Color(), PSD::Color::Grayscale);
+    EXPECT_EQ(layer.Depth(), PSD::Depth::Eight);
+    EXPECT_EQ(layer.Pixels()->channels.size(), 2u);
+    EXPECT_EQ(layer.Image(), PSD::LayerCast(PSD::Open(path_)[0]).Image());
+
+    // Writing to the layer swaps the planes for its RGBA8 image.
+    (*PSD::LayerCast(native[0]).Edit())[0][0] = 0;
+    EXPECT_EQ(PSD::LayerCast(native[0]).Pixels(), nullptr);
+}
+
+TEST_F(DocumentTest, NativeOpenRefusesWhatItCannotSave) {
+    PSD::Save(PSD::DocumentCreator()
+        .Push(PSD::Layer("layer", Fixture::PatternImage(9, 11)))
+        .Document(), path_);
+    // Same file at 16 bits, every sample widened to its U16 equivalent.
+    auto structure = Decompress(StructureFrom(path_));
+    auto widen = [](ByteView input) {
+        std::vector<U8> output(input.size() * sizeof(U16));
+        for (std::size_t index = 0; index < input.size(); ++index) {
+            auto sample = static_cast<U16>(input[index] * 257);
+            std::memcpy(output.data() + index * sizeof(U16), &sample, sizeof(U16));
+        }
+        return output;
+    };
+    auto layers = std::exchange(structure.info.layer_info, LayerInfo());
+    for (auto &record : layers.record) {
+        for (auto &[id, channel] : record.channel_data.data) {
+            channel = Channel(widen(channel.data));
+        }
+    }
+    layers.UpdateChannelInfo();
+    auto wide = structure;
+    wide.info.extra_info.Insert(Layer16(std::move(layers)));
+    wide.image.data   = widen(structure.image.data);
+    wide.header.depth = Depth::Sixteen;
+    DumpStructure(wide, path_);
+
+    // Deeper layers are not narrowed to 8 bits behind the caller's back.
+    PSD::OpenOptions options;
+    options.native = true;
+    auto native = PSD::Open(path_, options);
+    EXPECT_EQ(PSD::LayerCast(std::as_const(native)[0]).Depth(), PSD::Depth::Sixteen);
+    EXPECT_THROW(PSD::Save(native, path_), PSD::Error);
+    PSD::LayerCast(native[0]).Edit();
+    PSD::Save(native, path_);
+
+    // Colors that have no RGBA8 conversion fail on open, not on first use.
+    structure.header.color = PSD::Color::Cmyk;
+    DumpStructure(structure, path_);
+    EXPECT_THROW(PSD::Open(path_, options), PSD::Error);
+    EXPECT_THROW(PSD::Open(path_), PSD::Error);
+}
+
+TEST_F(DocumentTest, BoundsFollowNestedEdits) {
+    PSD::Group inner("inner");
+    inner.Push(PSD::Layer("layer", Fixture::PatternImage(9, 11, 1)));
+    PSD::Document document;
+    document.Push(std::move(inner));
+    document.Push(PSD::Layer("other", Fixture::PatternImage(9, 11, 2)));
+    EXPECT_EQ(document.RowCount(), 9u);
+    EXPECT_EQ(document.ColumnCount(), 11u);
+
+    // Offsets are x then y, the 9 x 11 image keeps its orientation.
+    auto &layer = PSD::LayerCast(PSD::GroupCast(document[0])[0]);
+    layer.SetOffset(5, 20);
+    auto bounds = layer.Bounds();
+    EXPECT_EQ(bounds.top, 20u);
+    EXPECT_EQ(bounds.left, 5u);
+    EXPECT_EQ(bounds.bottom, 29u);
+    EXPECT_EQ(bounds.right, 16u);
+    EXPECT_EQ(document.RowCount(), 29u);
+    EXPECT_EQ(document.ColumnCount(), 16u);
+
+    auto copy = document;
+    PSD::LayerCast(PSD::GroupCast(copy[0])[0]).SetOffset(0, 0);
+    EXPECT_EQ(copy.RowCount(), 9u);
+    EXPECT_EQ(document.RowCount(), 29u);
+}
+
+TEST_F(DocumentTest, EntriesOutliveTheirGroup) {
+    std::shared_ptr<PSD::Entry> held;
+    {
+        PSD::Document document;
+        document.Push(PSD::Layer("layer", Fixture::PatternImage(9, 11)));
+        held = document[0];
+    }
+    PSD::LayerCast(held).SetOffset(1, 2);
+    EXPECT_EQ(held->Bounds().top, 2u);
+
+    PSD::Group group;
+    group.Push(PSD::Layer("layer", Fixture::PatternImage(9, 11)));
+    held  = group[0];
+    group = PSD::Group();
+    EXPECT_EQ(group.Bounds().bottom, 0u);
+    PSD::LayerCast(held).SetOffset(3, 4);
+    EXPECT_EQ(group.Bounds().bottom, 0u);
+}
+
+TEST_F(DocumentTest, CopiesSharePixelsUntilWritten) {
+    PSD::Document document;
+    document.Push(PSD::Layer("layer", Fixture::PatternImage(9, 11, 1)));
+    auto copy = document;
+
+    const auto &original = PSD::LayerCast(std::as_const(document)[0]).Image();
+    auto       &shared   = PSD::LayerCast(copy[0]);
+    EXPECT_EQ(&*shared.Image().begin(), &*original.begin());
+    {
+        auto edit = shared.Edit();
+        (*edit)[0][0] = 0xee;
+
+        // Nothing is written through until the edit is over, copies taken
+        // meanwhile keep the pixels from before.
+        auto during = copy;
+        EXPECT_EQ(PSD::LayerCast(std::as_const(during)[0]).Image()[0][0], 0u);
+    }
+    EXPECT_EQ(original[0][0], 0u);
+    EXPECT_EQ(shared.Image()[0][0], 0xee);
+    EXPECT_FALSE(document == copy);
+}
+
+TEST_F(DocumentTest, LazyOpenDecodesOnFirstUse) {
+    PSD::Document document;
+    document.Push(PSD::Layer("first", Fixture::PatternImage(9, 11, 1)));
+    document.Push(PSD::Layer("second", Fixture::PatternImage(9, 11, 2)));
+    document.SetCompression(Compression::Default);
+    PSD::Save(document, path_);
+    auto original = ChannelBytes();
+
+    PSD::OpenOptions options;
+    options.lazy             = true;
+    options.reuse_channels   = true;
+    options.keep_compression = true;
+    auto opened = PSD::Open(path_, options);
+    const auto &first = PSD::LayerCast(std::as_const(opened)[0]);
+    EXPECT_TRUE(first.Packed());
+    EXPECT_EQ(first.Name(), "first");
+    EXPECT_EQ(opened.RowCount(), 9u);
+    EXPECT_EQ(opened.ColumnCount(), 11u);
+    EXPECT_TRUE(first.Packed());
+
+    // Copies decode once between them.
+    auto twin = opened;
+    EXPECT_TRUE(first.Image() == Fixture::PatternImage(9, 11, 1));
+    EXPECT_FALSE(first.Packed());
+    EXPECT_FALSE(PSD::LayerCast(std::as_const(twin)[0]).Packed());
+    // The twin keeps the decoded pixels, nothing is freed until it goes.
+    EXPECT_EQ(opened.Evict(), 0u);
+    EXPECT_TRUE(first.Packed());
+    EXPECT_FALSE(PSD::LayerCast(std::as_const(twin)[0]).Packed());
+    EXPECT_EQ(twin.Evict(), 9u * 11u * 4u);
+
+    // Unmodified layers are written back without being decoded, the edited
+    // one only gets its red channel recompressed.
+    (*PSD::LayerCast(opened[1]).Edit())[0][0] ^= 0xFF;
+    PSD::Save(opened, path_);
+    EXPECT_TRUE(first.Packed());
+    auto resaved = ChannelBytes();
+    ASSERT_EQ(resaved.size(), original.size());
+    for (unsigned channel = 0; channel < resaved.size(); ++channel) {
+        if (channel == 5) {
+            EXPECT_NE(resaved[channel], original[channel]);
+        } else {
+            EXPECT_EQ(resaved[channel], original[channel]);
+        }
+    }
+    // The packed channels still read from the file the save replaced.
+    EXPECT_TRUE(first.Image() == Fixture::PatternImage(9, 11, 1));
+}
+
+TEST_F(DocumentTest, PsbRoundTrip) {
+    PSD::Document document;
+    document.Push(PSD::Layer("first", Fixture::PatternImage(9, 11, 1)));
+    document.Push(PSD::Layer("second", Fixture::PatternImage(9, 11, 2)));
+    document.SetCompression(Compression::Default);
+    document.SetVersion(Version::PSB);
+    PSD::Save(document, path_);
+    EXPECT_EQ(Stream(path_).Read<Header>().version, Version::PSB);
+    auto original = ChannelBytes();
+
+    PSD::OpenOptions options;
+    options.reuse_channels   = true;
+    options.keep_compression = true;
+    auto opened = PSD::Open(path_, options);
+    EXPECT_EQ(opened.Version(), Version::PSB);
+    EXPECT_TRUE(opened == document);
+
+    // A plain re-save stays a PSB and writes every channel back as it was.
+    PSD::Save(opened, path_);
+    EXPECT_EQ(Stream(path_).Read<Header>().version, Version::PSB);
+    EXPECT_EQ(ChannelBytes(), original);
+    EXPECT_TRUE(PSD::Open(path_) == document);
+}
+
+TEST_F(DocumentTest, EvictLeavesCopiesAlone) {
+    Fixture::SaveLayers(path_, 1, Fixture::PatternImage(40, 30));
+    PSD::OpenOptions options;
+    options.lazy = true;
+    auto opened = PSD::Open(path_, options);
+    const auto snapshot = opened;
+    const auto &image = PSD::LayerCast(snapshot[0]).Image();
+    EXPECT_EQ(opened.Evict(), 0u);
+    EXPECT_TRUE(PSD::LayerCast(std::as_const(opened)[0]).Packed());
+    EXPECT_FALSE(PSD::LayerCast(snapshot[0]).Packed());
+    EXPECT_TRUE(image == Fixture::PatternImage(40, 30));
+    EXPECT_TRUE(PSD::LayerCast(std::as_const(opened)[0]).Image() == image);
+}
+
+TEST_F(DocumentTest, LazyCopiesDecodeOnceAcrossThreads) {
+    Fixture::SaveLayers(path_, 1, Fixture::PatternImage(40, 30));
+    PSD::OpenOptions options;
+    options.lazy = true;
+    const std::vector<PSD::Document> copies(4, PSD::Open(path_, options));
+
+    std::vector<const ::Image::Buffer<> *> images(copies.size());
+    std::vector<std::thread> threads;
+    for (unsigned index = 0; index < copies.size(); ++index) {
+        threads.emplace_back([&, index]() {
+            images[index] = &PSD::LayerCast(copies[index][0]).Image();
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (const auto *image : images) {
+        EXPECT_EQ(image, images[0]);
+    }
+    EXPECT_TRUE(*images[0] == Fixture::PatternImage(40, 30));
+}
+
+TEST_F(DocumentTest, NestedGroupsKeepTheirNames) {
+    PSD::Group inner("inner");
+    inner.Push(PSD::Layer("deep", Fixture::PatternImage(9, 11, 3)));
+    PSD::Group outer("outer");
+    outer.Push(PSD::Layer("shallow", Fixture::PatternImage(9, 11, 1)));
+    outer.Push(std::move(inner));
+    PSD::Document document;
+    document.Push(std::move(outer));
+    document.Push(PSD::Layer("top", Fixture::PatternImage(9, 11, 2)));
+    PSD::Save(document, path_);
+
+    auto opened = PSD::Open(path_);
+    EXPECT_TRUE(opened == document);
+    const auto &group = PSD::GroupCast(std::as_const(opened)[0]);
+    EXPECT_EQ(group.Name(), "outer");
+    EXPECT_EQ(group.Length(), 2u);
+    EXPECT_EQ(PSD::GroupCast(group[1]).Name(), "inner");
+    EXPECT_EQ(PSD::LayerCast(PSD::GroupCast(group[1])[0]).Name(), "deep");
+    EXPECT_EQ(PSD::LayerCast(std::as_const(opened)[1]).Name(), "top");
+}
+
+TEST_F(DocumentTest, GrayscaleCompositeRoundTrip) {
+    // The composite holds one plane per channel, one after the other.
+    std::vector<U8> gray(6 * 7);
+    for (unsigned index = 0; index < gray.size(); ++index) {
+        gray[index] = static_cast<U8>(index * 5);
+    }
+    auto rgb = ConvertColor(PSD::llapi::Image(gray), Color::Grayscale, Color::Rgb);
+    ASSERT_EQ(rgb.data.size(), gray.size() * 3);
+    for (unsigned plane = 0; plane < 3; ++plane) {
+        for (unsigned index = 0; index < gray.size(); ++index) {
+            EXPECT_EQ(rgb.data[plane * gray.size() + index], gray[index]);
+        }
+    }
+    auto back = ConvertColor(rgb, Color::Rgb, Color::Grayscale);
+    EXPECT_EQ(std::vector<U8>(back.data.begin(), back.data.end()), gray);
+
+    std::vector<U8> red(3 * 4, 0);
+    std::fill(red.begin(), red.begin() + 4, U8(255));
+    auto weighted = ConvertColor(PSD::llapi::Image(red), Color::Rgb, Color::Grayscale);
+    EXPECT_EQ(std::vector<U8>(weighted.data.begin(), weighted.data.end()), std::vector<U8>(4, 76));
+
+    // A grayscale save writes a single composite plane and says so.
+    PSD::Document document;
+    document.Push(PSD::Layer("gray", Fixture::PatternImage(6, 7)));
+    document.SetColor(Color::Grayscale);
+    PSD::Save(document, path_);
+    EXPECT_EQ(Stream(path_).Read<Header>().channel_count, 1u);
+    auto composite = PSD::Decode(path_);
+    EXPECT_EQ(composite.ChannelCount(), 1u);
+    EXPECT_EQ(composite.Length(), 6u * 7u);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <psd/document.h>
+
+#include <filesystem>
+#include <string>
+
+namespace Fixture {
+
+// RGBA8 image whose samples step every three pixels, `seed` sets the step.
+inline ::Image::Buffer<> PatternImage(unsigned row_count, unsigned column_count, unsigned seed = 1) {
+    ::Image::Buffer<> output(row_count, column_count);
+    for (unsigned index = 0; index < output.Length(); ++index) {
+        for (unsigned channel = 0; channel < 4; ++channel) {
+            output[index][channel] = static_cast<PSD::llapi::U8>(index / 3 * seed + channel);
+        }
+    }
+    return output;
+}
+
+// Saves `count` layers holding `image` to `path` and returns the document.
+inline PSD::Document SaveLayers(
+    const std::filesystem::path &path,
+    unsigned count,
+    const ::Image::Buffer<> &image,
+    PSD::Compression compression = PSD::Compression::Default
+) {
+    PSD::Document output;
+    for (unsigned index = 0; index < count; ++index) {
+        output.Push(PSD::Layer("layer " + std::to_string(index), image));
+    }
+    output.SetCompression(compression);
+    PSD::Save(output, path);
+    return output;
+}
+
+// File name under the temporary directory, removed with the object.
+class TemporaryPath {
+public:
+    explicit TemporaryPath(const std::string &name)
+        : path_(std::filesystem::temp_directory_path() / name) {}
+    ~TemporaryPath() {
+        std::error_code error;
+        std::filesystem::remove(path_, error);
+    }
+    TemporaryPath(const TemporaryPath &) = delete;
+    TemporaryPath &operator=(const TemporaryPath &) = delete;
+
+    operator const std::filesystem::path &() const { return path_; }
+    const std::filesystem::path &Path() const { return path_; }
+private:
+    std::filesystem::path path_;
+};
+
+} // namespace Fixture
@@ -0,0 +1,32 @@
+#include <gtest/gtest.h>
+#include <psd/llapi/executor.h>
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace PSD::llapi;
+
+TEST(ExecutorTest, RunsEveryJobAndRethrows) {
+    ThreadExecutor executor(4);
+    std::atomic<unsigned> count(0);
+
+    std::vector<Job> jobs(100, [&]() { count++; });
+    executor.Run(jobs);
+    EXPECT_EQ(count, 100u);
+
+    jobs.push_back([]() { throw std::runtime_error("job"); });
+    EXPECT_THROW(executor.Run(jobs), std::runtime_error);
+}
+
+TEST(ExecutorTest, NestedRunFinishesOnAFullPool) {
+    ThreadExecutor executor(2);
+    std::atomic<unsigned> count(0);
+    for (unsigned round = 0; round < 50; ++round) {
+        std::vector<Job> jobs(4, [&]() {
+            std::vector<Job> inner(8, [&]() { count++; });
+            executor.Run(inner);
+        });
+        executor.Run(jobs);
+    }
+    EXPECT_EQ(count, 50u * 4u * 8u);
+}
@@ -0,0 +1,108 @@
+#include "fixture.h"
+
+#include <gtest/gtest.h>
+#include <psd/document.h>
+#include <psd/llapi/index.h>
+
+#include <filesystem>
+#include <fstream>
+
+using namespace PSD::llapi;
+
+class IndexTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        Fixture::SaveLayers(path_, 2, Fixture::PatternImage(6, 5));
+    }
+    Fixture::TemporaryPath path_{"index_test.psd"};
+};
+
+TEST_F(IndexTest, SectionsCoverFile) {
+    auto index = IndexFrom(path_);
+
+    EXPECT_EQ(index.header_section, (Range{0, 26}));
+    EXPECT_EQ(index.color_section.offset, index.header_section.End());
+    EXPECT_EQ(index.resource_section.offset, index.color_section.End());
+    EXPECT_EQ(index.info_section.offset, index.resource_section.End());
+    EXPECT_EQ(index.image.offset, index.info_section.End());
+    EXPECT_EQ(index.image.End(), std::filesystem::file_size(path_));
+    EXPECT_EQ(index.image_compression, Compression::Default);
+}
+
+TEST_F(IndexTest, ChannelsReadBackInPlace) {
+    auto index     = IndexFrom(path_);
+    auto structure = StructureFrom(path_);
+    const auto &records = structure.info.layer_info.record;
+
+    ASSERT_EQ(index.layers.size(), records.size());
+
+    Stream stream(path_);
+    for (auto layer = 0u; layer < records.size(); ++layer) {
+        stream.SetPos(index.layers[layer].data.offset);
+        auto layer_data = stream.Read<LayerData>();
+        EXPECT_EQ(stream.Pos(), index.layers[layer].data.End());
+        EXPECT_EQ(layer_data.name, records[layer].layer_data.name);
+
+        for (const auto &entry : index.layers[layer].channels) {
+            stream.SetPos(entry.range.offset);
+            auto channel = stream.Read<Channel>(entry.range.length);
+            EXPECT_EQ(channel, records[layer].channel_data.data.at(entry.id));
+            EXPECT_EQ(entry.compression, Compression::Default);
+        }
+    }
+}
+
+TEST_F(IndexTest, SidecarCacheMatchesAndInvalidates) {
+    std::filesystem::path sidecar = path_;
+    sidecar += ".index";
+    std::filesystem::remove(sidecar);
+
+    auto expected = PSD::Open(path_);
+    auto missed   = PSD::Open(path_, {sidecar});
+    ASSERT_TRUE(std::filesystem::exists(sidecar));
+    auto hit      = PSD::Open(path_, {sidecar});
+    EXPECT_TRUE(missed == expected);
+    EXPECT_TRUE(hit == expected);
+
+    PSD::Document changed;
+    changed.Push(PSD::Layer("third", ::Image::Buffer<>(3, 3)));
+    PSD::Save(changed, path_);
+    EXPECT_TRUE(PSD::Open(path_, {sidecar}) == changed);
+
+    std::filesystem::remove(sidecar);
+}
+
+TEST_F(IndexTest, DamagedSidecarIsAMiss) {
+    std::filesystem::path sidecar = path_;
+    sidecar += ".index";
+    auto expected = PSD::Open(path_, {sidecar});
+
+    // Layer count, after signature, format, key, header and three ranges.
+    std::fstream file(sidecar, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(4 + 4 + 24 + 26 + 3 * 16);
+    file.write("\xFF\xFF\xFF\xFF", 4);
+    file.close();
+
+    Stream stream(path_);
+    auto key = *CacheKey::From(path_, stream);
+    EXPECT_FALSE(IndexCache::Load(sidecar, key));
+    EXPECT_TRUE(PSD::Open(path_, {sidecar}) == expected);
+    EXPECT_TRUE(IndexCache::Load(sidecar, key));
+    std::filesystem::remove(sidecar);
+}
+
+TEST_F(IndexTest, CacheKeyHashesSmallFilesWhole) {
+    Fixture::TemporaryPath path{"index_test.dat"};
+    std::vector<char> bytes(10000, 0x11);
+    std::ofstream(path.Path(), std::ios::binary).write(bytes.data(), bytes.size());
+    Stream before(path);
+    auto key = *CacheKey::From(path, before);
+
+    // A same-size edit past the first 4 KiB, with the mtime put back.
+    auto mtime = std::filesystem::last_write_time(path);
+    bytes[8000] = 0x22;
+    std::ofstream(path.Path(), std::ios::binary).write(bytes.data(), bytes.size());
+    std::filesystem::last_write_time(path, mtime);
+    Stream after(path);
+    EXPECT_NE(*CacheKey::From(path, after), key);
+}
@@ -215,3 +215,176 @@ TEST_F(StreamTest, LargeDataWrite) {
 
     EXPECT_EQ(read_data, large_data);
 }
+
+TEST_F(StreamTest, FileConstructorMapsFile) {
+    PSD::llapi::Stream stream(test_file_path_);
+    EXPECT_TRUE(stream.Mapped());
+    EXPECT_EQ(stream.Length(), 8u);
+}
+
+TEST_F(StreamTest, FileConstructorMissingFile) {
+    EXPECT_THROW(
+        PSD::llapi::Stream stream(test_file_path_.string() + ".missing"),
+        PSD::Error
+    );
+}
+
+TEST_F(StreamTest, WriteAfterMappedRead) {
+    PSD::llapi::Stream stream(test_file_path_, PSD::llapi::Advice::Random);
+    stream.SetPos(2);
+    stream.Write<PSD::llapi::U16>(0xAABB);
+    EXPECT_FALSE(stream.Mapped());
+
+    stream.SetPos(0);
+    EXPECT_EQ(stream.Read<PSD::llapi::U32>(), 0x0102AABB);
+
+    PSD::llapi::Stream original(test_file_path_);
+    EXPECT_EQ(original.Read<PSD::llapi::U32>(), 0x01020304);
+}
+
+TEST_F(StreamTest, BorrowOutlivesStream) {
+    PSD::llapi::Bytes bytes;
+    {
+        PSD::llapi::Stream stream(test_file_path_);
+        stream += 2;
+        bytes = stream.Borrow(4);
+        EXPECT_EQ(stream.Pos(), 6u);
+    }
+    EXPECT_TRUE(bytes.Borrowed());
+    EXPECT_EQ(bytes, PSD::llapi::Bytes(std::vector<PSD::llapi::U8>{0x03, 0x04, 0x05, 0x06}));
+
+    bytes.Materialize()[0] = 0xFF;
+    EXPECT_FALSE(bytes.Borrowed());
+    EXPECT_EQ(bytes[0], 0xFF);
+}
+
+TEST_F(StreamTest, BorrowFromOwnedBuffer) {
+    PSD::llapi::Stream stream(std::vector<PSD::llapi::U8>{0x01, 0x02, 0x03});
+    auto bytes = stream.Borrow(3);
+    EXPECT_EQ(bytes.size(), 3u);
+
+    stream.SetPos(0);
+    stream.Write<PSD::llapi::U8>(0x09);
+    EXPECT_EQ(bytes[0], 0x01);
+    stream.SetPos(0);
+    EXPECT_EQ(stream.Read<PSD::llapi::U8>(), 0x09);
+}
+
+TEST_F(StreamTest, LengthWidthFollowsVersion) {
+    PSD::llapi::Stream stream;
+    auto start = stream.ReserveLength();
+    stream.Write<PSD::llapi::U16>(0x1234);
+    stream.PatchLength(start);
+    EXPECT_EQ(stream.Length(), 6u);
+
+    stream.SetVersion(PSD::llapi::Version::PSB);
+    start = stream.ReserveLength();
+    stream.Write<PSD::llapi::U8>(0x56);
+    stream.PatchLength(start);
+    EXPECT_EQ(stream.Length(), 15u);
+
+    stream.SetPos(0);
+    EXPECT_EQ(stream.ReadLength(false), 2u);
+    stream += 2;
+    EXPECT_EQ(stream.ReadLength(), 1u);
+}
+
+TEST_F(StreamTest, SinkPatchesFlushedLength) {
+    std::vector<PSD::llapi::U8> payload(3u << 20, 0x5A);
+    {
+        PSD::llapi::Sink sink(test_file_path_);
+        PSD::llapi::Stream stream(sink);
+        auto start = stream.ReserveLength();
+        stream.Write(payload);
+        stream.Write<PSD::llapi::U16>(0xBEEF);
+        stream.PatchLength(start);
+        stream.Flush();
+        EXPECT_EQ(sink.Length(), payload.size() + 6);
+        sink.Commit();
+    }
+    PSD::llapi::Stream stream(test_file_path_);
+    EXPECT_EQ(stream.Length(), payload.size() + 6);
+    EXPECT_EQ(stream.Read<PSD::llapi::U32>(), payload.size() + 2);
+    stream += payload.size();
+    EXPECT_EQ(stream.Read<PSD::llapi::U16>(), 0xBEEF);
+}
+
+TEST_F(StreamTest, SinkKeepsFileUntilCommit) {
+    {
+        PSD::llapi::Sink sink(test_file_path_);
+        PSD::llapi::Stream stream(sink);
+        stream.Write<PSD::llapi::U32>(0xDEADBEEF);
+        stream.Flush();
+    }
+    // The file SetUp wrote is untouched, and no temporary is left behind.
+    PSD::llapi::Stream stream(test_file_path_);
+    EXPECT_EQ(stream.Length(), 8u);
+    EXPECT_EQ(stream.Read<PSD::llapi::U8>(), 0x01);
+    auto prefix = "." + test_file_path_.filename().string() + ".";
+    for (const auto &entry : std::filesystem::directory_iterator(test_file_path_.parent_path())) {
+        EXPECT_NE(entry.path().filename().string().rfind(prefix, 0), 0u);
+    }
+}
+
+#ifndef _WIN32
+TEST_F(StreamTest, SinkReplacesLinkTargetKeepingMode) {
+    namespace fs = std::filesystem;
+    auto link = test_file_path_.parent_path() / "stream_test.link";
+    fs::remove(link);
+    fs::create_symlink(test_file_path_.filename(), link);
+    fs::permissions(test_file_path_, fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    {
+        PSD::llapi::Sink sink(link);
+        PSD::llapi::Stream stream(sink);
+        stream.Write<PSD::llapi::U32>(0xDEADBEEF);
+        stream.Flush();
+        sink.Commit();
+    }
+    EXPECT_TRUE(fs::is_symlink(link));
+    EXPECT_EQ(fs::status(test_file_path_).permissions(),
+              fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    PSD::llapi::Stream stream(test_file_path_);
+    EXPECT_EQ(stream.Read<PSD::llapi::U32>(), 0xDEADBEEF);
+    fs::remove(link);
+}
+#endif
+
+TEST_F(StreamTest, BulkSwapMatchesScalar) {
+    std::vector<PSD::llapi::U16> u16(37);
+    std::vector<PSD::llapi::U32> u32(37);
+    std::vector<PSD::llapi::U64> u64(37);
+    std::vector<PSD::llapi::F32> f32(37);
+    for (size_t i = 0; i < 37; ++i) {
+        u16[i] = static_cast<PSD::llapi::U16>(i * 0x0101 + 1);
+        u32[i] = static_cast<PSD::llapi::U32>(i * 0x01020304 + 7);
+        u64[i] = i * 0x0102030405060708ULL + 9;
+        f32[i] = static_cast<PSD::llapi::F32>(i) * 0.25f;
+    }
+    PSD::llapi::Stream stream;
+    stream.Write(u16.begin(), u16.end());
+    stream.Write(u32.begin(), u32.end());
+    stream.Write(u64.begin(), u64.end());
+    stream.Write(f32.begin(), f32.end());
+    EXPECT_EQ(stream.Length(), 37u * (2 + 4 + 8 + 4));
+
+    stream.SetPos(0);
+    EXPECT_EQ(stream.Read<PSD::llapi::U16>(), u16[0]);
+    stream.SetPos(2 * 36);
+    EXPECT_EQ(stream.Read<PSD::llapi::U16>(), u16[36]);
+    EXPECT_EQ(stream.Read<PSD::llapi::U32>(), u32[0]);
+
+    stream.SetPos(0);
+    std::vector<PSD::llapi::U16> r16(37);
+    std::vector<PSD::llapi::U32> r32(37);
+    std::vector<PSD::llapi::U64> r64(37);
+    std::vector<PSD::llapi::F32> rf32(37);
+    stream.Read(r16.begin(), r16.end());
+    stream.Read(r32.begin(), r32.end());
+    stream.Read(r64.begin(), r64.end());
+    stream.Read(rf32.begin(), rf32.end());
+    EXPECT_EQ(r16, u16);
+    EXPECT_EQ(r32, u32);
+    EXPECT_EQ(r64, u64);
+    EXPECT_EQ(rf32, f32);
+    EXPECT_THROW(stream.Read(r16.begin(), r16.end()), PSD::Error);
+}
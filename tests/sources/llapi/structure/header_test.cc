@@ -213,3 +213,20 @@ TEST_F(HeaderTest, HeaderRoundTrip) {
 
     EXPECT_EQ(read_header, original);
 }
+
+TEST_F(HeaderTest, HeaderDimensionLimits) {
+    Header header;
+    header.row_count = 30001;
+    header.column_count = 16;
+
+    Stream stream;
+    EXPECT_THROW(stream.Write(header), PSD::Error);
+
+    header.version = Header::VersionFor(header.row_count, header.column_count);
+    EXPECT_EQ(header.version, Version::PSB);
+    EXPECT_NO_THROW(stream.Write(header));
+    EXPECT_TRUE(stream.Large());
+
+    header.row_count = 300001;
+    EXPECT_THROW(stream.Write(header), PSD::Error);
+}
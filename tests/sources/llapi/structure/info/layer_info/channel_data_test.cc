@@ -0,0 +1,278 @@
+#include "fixture.h"
+
+#include <gtest/gtest.h>
+#include <psd/llapi/structure/info/layer_info.h>
+#include <psd/llapi/structure/info/layer_info/channel_data.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace PSD::llapi;
+
+class ChannelDataTest : public ::testing::Test {};
+
+TEST_F(ChannelDataTest, RleRoundTrip) {
+    const unsigned rows = 7, columns = 517;
+    std::vector<U8> data(rows * columns);
+    for (unsigned index = 0; index < data.size(); ++index) {
+        // Alternating stretches of repeats and literals of varying length.
+        data[index] = (index / 97) % 2 ? static_cast<U8>(index * 31) : static_cast<U8>(index / 45);
+    }
+    for (auto version : {Version::PSD, Version::PSB}) {
+        auto compressed = CompressDefault(data, rows, columns, Depth::Eight, 0, version);
+        EXPECT_EQ(DecompressDefault(compressed, rows, columns, Depth::Eight, version), data);
+    }
+}
+
+TEST_F(ChannelDataTest, RleRejectsTruncatedTable) {
+    std::vector<U8> data = {0x00, 0x02, 0x00};
+    EXPECT_THROW(DecompressDefault(data, 2, 4, Depth::Eight), PSD::Error);
+}
+
+TEST_F(ChannelDataTest, RleRejectsCountsPastInput) {
+    std::vector<U8> data = {0x00, 0x09, 0xFD, 0x01};
+    EXPECT_THROW(DecompressDefault(data, 1, 4, Depth::Eight), PSD::Error);
+}
+
+TEST_F(ChannelDataTest, RleRejectsRowOverflow) {
+    std::vector<U8> data = {0x00, 0x02, 0xF0, 0x01};
+    EXPECT_THROW(DecompressDefault(data, 1, 4, Depth::Eight), PSD::Error);
+
+    std::vector<U8> literal = {0x00, 0x03, 0x04, 0x01, 0x02};
+    EXPECT_THROW(DecompressDefault(literal, 1, 4, Depth::Eight), PSD::Error);
+}
+
+TEST_F(ChannelDataTest, DeflateDeltaHighDepthRoundTrip) {
+    const unsigned rows = 9, columns = 301;
+    std::vector<U8> data16(rows * columns * sizeof(U16));
+    auto samples16 = reinterpret_cast<U16 *>(data16.data());
+    for (unsigned index = 0; index < rows * columns; ++index) {
+        samples16[index] = static_cast<U16>(index * 211);
+    }
+    auto delta16 = CompressDeflateDelta(data16, rows, columns, Depth::Sixteen, 6);
+    EXPECT_EQ(DecompressDeflateDelta(delta16, rows, columns, Depth::Sixteen), data16);
+    EXPECT_LT(delta16.size(), CompressDeflate(data16, rows, columns, Depth::Sixteen, 6).size());
+
+    std::vector<U8> data32(rows * columns * sizeof(F32));
+    auto samples32 = reinterpret_cast<F32 *>(data32.data());
+    for (unsigned index = 0; index < rows * columns; ++index) {
+        samples32[index] = static_cast<F32>(index % columns) / columns + rows;
+    }
+    auto delta32 = CompressDeflateDelta(data32, rows, columns, Depth::ThirtyTwo, 6);
+    EXPECT_EQ(DecompressDeflateDelta(delta32, rows, columns, Depth::ThirtyTwo), data32);
+}
+
+TEST_F(ChannelDataTest, AdaptivePicksByContent) {
+    const unsigned rows = 64, columns = 64;
+    std::vector<U8> transparent(rows * columns, 0x00);
+    std::vector<U8> gradient(rows * columns);
+    for (unsigned index = 0; index < gradient.size(); ++index) {
+        gradient[index] = static_cast<U8>(index % columns + index / columns);
+    }
+    std::vector<U8> noise(rows * columns);
+    for (unsigned index = 0, state = 1; index < noise.size(); ++index) {
+        state = state * 1103515245 + 12345;
+        noise[index] = static_cast<U8>(state >> 16);
+    }
+    EXPECT_EQ(ChooseCompression(noise, rows, columns, Depth::Eight, 6), Compression::None);
+    EXPECT_EQ(ChooseCompression(gradient, rows, columns, Depth::Eight, 6), Compression::DeflateDelta);
+
+    AdaptiveBudget budget;
+    budget.ceiling = Compression::Default;
+    EXPECT_EQ(ChooseCompression(transparent, rows, columns, Depth::Eight, 6, Version::PSD, budget),
+              Compression::Default);
+}
+
+TEST_F(ChannelDataTest, DecodeToSixteenBitEveryCodec) {
+    const unsigned rows = 5, columns = 133;
+    std::vector<U8> native(rows * columns * sizeof(U16)), file(native.size());
+    std::vector<U8> expected(rows * columns * 2, 0x00);
+    for (unsigned index = 0; index < rows * columns; ++index) {
+        auto value = static_cast<U16>((index / 7) * 1031);
+        std::memcpy(native.data() + index * sizeof(U16), &value, sizeof(U16));
+        file[index * 2]     = static_cast<U8>(value >> 8);
+        file[index * 2 + 1] = static_cast<U8>(value);
+        expected[index * 2] = static_cast<U8>((U32(value) * 255 + 32767) / 65535);
+    }
+    std::vector<std::pair<Compression, std::vector<U8>>> inputs = {
+        {Compression::None,         file},
+        {Compression::Default,      CompressDefault(file, rows, columns, Depth::Sixteen, 0)},
+        {Compression::Deflate,      CompressDeflate(file, rows, columns, Depth::Sixteen, 6)},
+        {Compression::DeflateDelta, CompressDeflateDelta(native, rows, columns, Depth::Sixteen, 6)},
+    };
+    for (const auto &[compression, input] : inputs) {
+        std::vector<U8> output(expected.size(), 0x00);
+        DecodeChannelTo(input, compression, rows, columns, Depth::Sixteen, Version::PSD, output.data(), 2);
+        EXPECT_EQ(output, expected) << static_cast<unsigned>(compression);
+    }
+}
+
+TEST_F(ChannelDataTest, RowDecoderMatchesWholeChannel) {
+    const unsigned rows = 6, columns = 211;
+    std::vector<U8> data8(rows * columns);
+    for (unsigned index = 0; index < data8.size(); ++index) {
+        data8[index] = static_cast<U8>((index / 13) * 7);
+    }
+    auto rle = CompressDefault(data8, rows, columns, Depth::Eight, 0, Version::PSB);
+    RowDecoder decoder(rle, Compression::Default, rows, columns, Depth::Eight, Version::PSB);
+    for (unsigned row = 0; row < rows; ++row) {
+        auto view = decoder.Next();
+        EXPECT_EQ(std::vector<U8>(view.data(), view.data() + view.size()),
+                  std::vector<U8>(data8.begin() + row * columns, data8.begin() + (row + 1) * columns));
+    }
+    EXPECT_TRUE(decoder.Done());
+    EXPECT_THROW(decoder.Next(), PSD::Error);
+
+    std::vector<U8> data32(rows * columns * sizeof(F32));
+    auto samples32 = reinterpret_cast<F32 *>(data32.data());
+    for (unsigned index = 0; index < rows * columns; ++index) {
+        samples32[index] = static_cast<F32>(index % columns) / columns;
+    }
+    Channel channel(CompressDeflateDelta(data32, rows, columns, Depth::ThirtyTwo, 6));
+    channel.compression = Compression::DeflateDelta;
+    RowDecoder delta(channel, rows, columns, Depth::ThirtyTwo);
+    std::vector<U8> output;
+    while (!delta.Done()) {
+        auto view = delta.Next();
+        output.insert(output.end(), view.data(), view.data() + view.size());
+    }
+    EXPECT_EQ(output, data32);
+}
+
+TEST_F(ChannelDataTest, RowDecoderStreamsPastInflateLimit) {
+    const unsigned rows = 9, columns = 173;
+    std::vector<U8> data(rows * columns * sizeof(U16));
+    auto samples = reinterpret_cast<U16 *>(data.data());
+    for (unsigned index = 0; index < rows * columns; ++index) {
+        samples[index] = static_cast<U16>(index * 257 / 3);
+    }
+    for (auto compression : {Compression::Deflate, Compression::DeflateDelta}) {
+        Channel channel(Compress(data, rows, columns, Depth::Sixteen, compression, 6));
+        channel.compression = compression;
+        RowDecoder whole(channel, rows, columns, Depth::Sixteen);
+        RowDecoder streamed(channel, rows, columns, Depth::Sixteen, Version::PSD, 0);
+        whole.Skip(2);
+        streamed.Skip(2);
+        while (!whole.Done()) {
+            auto expected = whole.Next();
+            auto actual   = streamed.Next();
+            EXPECT_EQ(std::vector<U8>(actual.begin(), actual.end()),
+                      std::vector<U8>(expected.begin(), expected.end()));
+        }
+        EXPECT_TRUE(streamed.Done());
+
+        ByteView half(channel.data.data(), channel.data.size() / 2);
+        RowDecoder truncated(half, compression, rows, columns, Depth::Sixteen, Version::PSD, 0);
+        EXPECT_THROW(truncated.Skip(rows), PSD::Error);
+    }
+}
+
+TEST_F(ChannelDataTest, ChunkedDeflateIsOneZlibStream) {
+    const unsigned rows = 1500, columns = 2000;
+    std::vector<U8> data(rows * columns);
+    for (unsigned index = 0; index < data.size(); ++index) {
+        data[index] = static_cast<U8>((index % columns) / 5 + (index / columns) % 7 + (index * 2654435761u >> 29));
+    }
+    ASSERT_GE(data.size(), 2 * DeflateChunkLength);
+    ThreadExecutor serial(1), parallel(4);
+    for (auto level : {0u, 1u, 6u, 9u, 12u}) {
+        auto chunked = CompressDeflate(data, rows, columns, Depth::Eight, level, Version::PSD, &parallel);
+        EXPECT_EQ(chunked, CompressDeflate(data, rows, columns, Depth::Eight, level, Version::PSD, &serial));
+        EXPECT_EQ(DecompressDeflate(chunked, rows, columns, Depth::Eight), data);
+    }
+    auto delta = CompressDeflateDelta(data, rows, columns, Depth::Eight, 6, Version::PSD, &parallel);
+    EXPECT_EQ(DecompressDeflateDelta(delta, rows, columns, Depth::Eight), data);
+}
+
+TEST_F(ChannelDataTest, LayerChunksShareOneBatch) {
+    // Runs jobs in order on the calling thread, counting nested batches.
+    class CountingExecutor : public Executor {
+    public:
+        void Run(std::vector<Job> &jobs) override {
+            depth++;
+            max_depth = std::max(max_depth, depth);
+            batch_count++;
+            for (auto &job : jobs) {
+                job();
+            }
+            depth--;
+        }
+        unsigned depth = 0, max_depth = 0, batch_count = 0;
+    };
+    const unsigned rows = 1100, columns = 2000;
+    std::vector<U8> data(rows * columns);
+    for (unsigned index = 0; index < data.size(); ++index) {
+        data[index] = static_cast<U8>((index % columns) / 3 + (index * 2654435761u >> 30));
+    }
+    ThreadExecutor parallel(4);
+    for (auto compression : {Compression::Deflate, Compression::DeflateDelta}) {
+        LayerInfo info;
+        auto &record = info.record.emplace_back();
+        record.layer_data.coordinates.bottom = rows;
+        record.layer_data.coordinates.right  = columns;
+        record.channel_data.data[0] = Channel(data);
+
+        CountingExecutor executor;
+        info.Compress(compression, 6, Header(rows, columns), executor);
+        EXPECT_EQ(executor.max_depth, 1u);
+        EXPECT_EQ(executor.batch_count, 1u);
+
+        const auto &channel = info.record[0].channel_data.data.at(0);
+        EXPECT_EQ(channel.compression, compression);
+        auto expected = Compress(data, rows, columns, Depth::Eight, compression, 6, Version::PSD, &parallel);
+        EXPECT_EQ(std::vector<U8>(channel.data.begin(), channel.data.end()), expected);
+    }
+}
+
+TEST_F(ChannelDataTest, DepthConversionRounds) {
+    std::vector<U8> samples16(0x10000 * sizeof(U16));
+    for (unsigned value = 0; value < 0x10000; ++value) {
+        auto sample = static_cast<U16>(value);
+        std::memcpy(samples16.data() + value * sizeof(U16), &sample, sizeof(U16));
+    }
+    auto samples8 = detail::ConvertDepth(samples16, Depth::Sixteen, Depth::Eight);
+    ASSERT_EQ(samples8.size(), 0x10000u);
+    for (unsigned value = 0; value < 0x10000; ++value) {
+        EXPECT_EQ(samples8[value], (value * 255 + 32767) / 65535) << value;
+    }
+    std::vector<U8> bytes(256);
+    for (unsigned value = 0; value < 256; ++value) {
+        bytes[value] = static_cast<U8>(value);
+    }
+    EXPECT_EQ(detail::ConvertDepth(detail::ConvertDepth(bytes, Depth::Eight, Depth::Sixteen), Depth::Sixteen, Depth::Eight), bytes);
+    EXPECT_EQ(detail::ConvertDepth(detail::ConvertDepth(bytes, Depth::Eight, Depth::ThirtyTwo), Depth::ThirtyTwo, Depth::Eight), bytes);
+}
+
+TEST_F(ChannelDataTest, ParallelDecompressMatchesSerial) {
+    Fixture::TemporaryPath path("parallel_decompress_test.psd");
+    Fixture::SaveLayers(path, 6, Fixture::PatternImage(40, 30));
+
+    ThreadExecutor serial(1);
+    ThreadExecutor parallel(4);
+    auto expected = Decompress(StructureFrom(path), serial);
+    auto actual   = Decompress(StructureFrom(path), parallel);
+
+    const auto &expected_records = expected.info.layer_info.record;
+    const auto &actual_records   = actual.info.layer_info.record;
+    ASSERT_EQ(actual_records.size(), expected_records.size());
+    for (auto index = 0u; index < actual_records.size(); ++index) {
+        EXPECT_FALSE(actual_records[index].channel_data.Compressed());
+        EXPECT_EQ(actual_records[index].channel_data, expected_records[index].channel_data);
+        EXPECT_EQ(actual_records[index].layer_data.channel_info,
+                  expected_records[index].layer_data.channel_info);
+    }
+}
+
+TEST_F(ChannelDataTest, ParallelCompressMatchesSerial) {
+    Fixture::TemporaryPath path("parallel_compress_test.psd");
+    Fixture::SaveLayers(path, 6, Fixture::PatternImage(37, 23, 5));
+    auto structure = Decompress(StructureFrom(path));
+
+    ThreadExecutor serial(1);
+    ThreadExecutor parallel(4);
+    for (auto compression : {Compression::Default, Compression::Deflate}) {
+        std::vector<U8> expected, actual;
+        DumpStructure(Compress(structure, compression, 6, serial), expected);
+        DumpStructure(Compress(structure, compression, 6, parallel), actual);
+        EXPECT_EQ(actual, expected);
+    }
+}